@@ -15,8 +15,11 @@
 #include "define_can.h"
 
 
-void configure_CAN(CAN_HandleTypeDef *hcan, can_address_t adresse);
-int format_frame(can_message_t *msg, CAN_RxHeaderTypeDef frame, const uint8_t data[]);
-int send(CAN_HandleTypeDef *hcan, can_address_t address, function_code_t functionCode , uint8_t data[], uint8_t length, uint8_t messageID, bool isResponse);
+void configure_CAN(CAN_HandleTypeDef *hcan, CanBus_Address adresse);
+int format_frame(CanBus_FrameFormat *msg, CAN_RxHeaderTypeDef frame, const uint8_t data[]);
+int send(
+        CAN_HandleTypeDef *hcan, CanBus_Priority priority, CanBus_Address address, CanBus_Fnct_Mode functionMode,
+        CanBus_Fnct_Code functionCode, const uint8_t data[], uint8_t length, uint8_t messageID, bool isResponse
+);
 
 #endif /* CAN_H */
@@ -9,10 +9,10 @@
 
 #include "can.h"
 
-can_address_t canAddress;
+CanBus_Address canAddress;
 
 
-void configure_CAN(CAN_HandleTypeDef *hcan, can_address_t addr) {
+void configure_CAN(CAN_HandleTypeDef *hcan, CanBus_Address addr) {
     canAddress = addr;
     HAL_CAN_Start(hcan);                                             // Démarrer le périphérique CAN
     HAL_CAN_ActivateNotification(hcan, CAN_IT_RX_FIFO0_MSG_PENDING); // Activer le mode interruption
@@ -24,40 +24,55 @@ void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan) {
 	CAN_RxHeaderTypeDef RxHeader;
 	HAL_CAN_GetRxMessage(hcan, CAN_RX_FIFO0, &RxHeader, RxData);
 
-	can_message_t msg;
+	CanBus_FrameFormat msg;
     if (format_frame(&msg, RxHeader, RxData) != 0)
         return;
 
-    switch (msg.functionCode) {
-        case FCT_ACCUSER_RECPETION:
-            send(hcan, msg.senderAddress, FCT_ACCUSER_RECPETION, msg.data, 1, msg.messageID, true);
+    // La réponse reprend la priorité, le mode et l'ID message de la requête
+    switch (msg.FunctionCode) {
+        case FCT_ACCUSER_RECEPTION:
+            send(hcan, msg.Priority, msg.SenderAddress, msg.FunctionMode, FCT_ACCUSER_RECEPTION, msg.Data, 1, msg.MessageID, true);
+            break;
         default:
             break;
     }
 }
 
 
-int format_frame(can_message_t *rep, CAN_RxHeaderTypeDef frame, const uint8_t data[]) {
-    rep->receiverAddress = (frame.ExtId & CAN_MASK_RECEIVER_ADDR) >> CAN_OFFSET_RECEIVER_ADDR;
+int format_frame(CanBus_FrameFormat *rep, CAN_RxHeaderTypeDef frame, const uint8_t data[]) {
+    // Seules les trames étendues (29 bits) de données suivent la disposition de can_id_layout.h
+    if (frame.IDE != CAN_ID_EXT || frame.RTR != CAN_RTR_DATA || frame.DLC > 8)
+        return -1;
+
+    rep->ReceiverAddress = CAN_ID_GET(frame.ExtId, RECEIVER_ADDR);
 
-    if (rep->receiverAddress != canAddress && rep->receiverAddress != CAN_ADDR_BROADCAST)
+    if (rep->ReceiverAddress != canAddress && rep->ReceiverAddress != CANBUS_BROADCAST)
         return -1;
 
-    rep->senderAddress = (frame.ExtId & CAN_MASK_EMIT_ADDR) >> CAN_OFFSET_EMIT_ADDR;
-    rep->functionCode = (frame.ExtId & CAN_MASK_FUNCTION_CODE) >> CAN_OFFSET_FUNCTION_CODE;
-    rep->messageID = (frame.ExtId & CAN_MASK_MESSAGE_ID) >> CAN_OFFSET_MESSAGE_ID;
-    rep->isResponse = (frame.ExtId & CAN_MASK_IS_RESPONSE);
+    rep->Priority = CAN_ID_GET(frame.ExtId, PRIORITY);
+    rep->SenderAddress = CAN_ID_GET(frame.ExtId, EMIT_ADDR);
+    rep->FunctionMode = CAN_ID_GET(frame.ExtId, FUNCTION_MODE);
+    rep->FunctionCode = CAN_ID_GET(frame.ExtId, FUNCTION_CODE);
+    rep->MessageID = CAN_ID_GET(frame.ExtId, MESSAGE_ID);
+    rep->IsResp = CAN_ID_GET(frame.ExtId, IS_RESPONSE);
 
     for (int i = 0; i < frame.DLC; i++){
-        rep->data[i] = data[i];
+        rep->Data[i] = data[i];
     }
 
-    rep->length = frame.DLC;
+    rep->Length = frame.DLC;
+    rep->IsFD = false;
+    rep->BitRateSwitch = false;
+    rep->Timestamp = 0;
+    rep->HardwareTimestamp = 0;
     return 0;
 }
 
 
-int send(CAN_HandleTypeDef *hcan, can_address_t address, function_code_t functionCode , uint8_t data[], uint8_t length, uint8_t messageID, bool isResponse) {
+int send(
+        CAN_HandleTypeDef *hcan, CanBus_Priority priority, CanBus_Address address, CanBus_Fnct_Mode functionMode,
+        CanBus_Fnct_Code functionCode, const uint8_t data[], uint8_t length, uint8_t messageID, bool isResponse
+) {
     if (length > 8)
         return -1;
 
@@ -67,14 +82,11 @@ int send(CAN_HandleTypeDef *hcan, can_address_t address, function_code_t functio
     txHeader.RTR = CAN_RTR_DATA;
     txHeader.TransmitGlobalTime = DISABLE;
 
-	txHeader.ExtId = canAddress << CAN_OFFSET_EMIT_ADDR |
-                     address << CAN_OFFSET_RECEIVER_ADDR |
-                     functionCode << CAN_OFFSET_FUNCTION_CODE |
-                     messageID << CAN_OFFSET_MESSAGE_ID |
-                     isResponse;
+	txHeader.ExtId = can_id_encode(priority, canAddress, address, functionMode, functionCode, messageID, isResponse);
 
 	uint32_t TxMailbox;
-	HAL_CAN_AddTxMessage(hcan, &txHeader, data, &TxMailbox);
+	if (HAL_CAN_AddTxMessage(hcan, &txHeader, (uint8_t *) data, &TxMailbox) != HAL_OK)
+        return -1;
 
 	return 0;
 }
@@ -87,7 +87,7 @@ int main(void)
   MX_GPIO_Init();
   MX_CAN1_Init();
   /* USER CODE BEGIN 2 */
-  configure_CAN(&hcan1, CAN_ADDR_ODOMETRIE);
+  configure_CAN(&hcan1, CANBUS_ODOMETRIE);
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -11,19 +11,36 @@
 #define RASPI_CAN_H
 
 #include <map>
+#include <string>
+#include <deque>
 #include <mutex>
+#include <chrono>
+#include <memory>
 #include <vector>
 #include <thread>
 #include <atomic>
+#include <span>
+#include <array>
+#include <future>
+#include <coroutine>
 #include <functional>
+#include <condition_variable>
 #include <linux/can.h>
+#include <sys/socket.h>
 #include <robotech/logs.h>
 
 #include "define_can.h"
+#include "can_id.h"
+#include "can_schema.h"
+#include "can_dispatcher.h"
+#include "can_scheduler.h"
+#include "can_queue.h"
 
 
 // Pré-déclaration pour utiliser la classe CAN dans can_callback_t
 class CAN;
+class CanEventLoop;
+class CanRecorder;
 
 // Type des fonctions de callback
 typedef std::function<void(CAN &can, const CanBus_FrameFormat &frame)> can_callback_t;
@@ -36,37 +53,481 @@ enum can_status_t {
 // Structure pour stocker les réponses
 struct can_result_t {
     can_status_t status;
-    CanBus_FrameFormat frame;
+    CanBus_FrameFormat frame{};
+    uint64_t TxTimestamp{0};   // Émission de la requête en ns (setReceiveOwnMessages), même horloge que frame.Timestamp, 0 sinon
+};
+
+
+// Fonction appelée à la fin d'une requête asynchrone (réponse, timeout ou erreur)
+typedef std::function<void(const can_result_t &result)> can_completion_t;
+
+// Nombre d'adresses et d'ID message différents (champs de 4 bits)
+constexpr int CAN_ADDRESS_COUNT = CAN_FIELD_EMIT_ADDR.max() + 1;
+constexpr int CAN_MESSAGE_ID_COUNT = CAN_FIELD_MESSAGE_ID.max() + 1;
+
+// Nombre de codes fonction représentables dans l'identifiant (taille de la table de dispatch)
+constexpr int CAN_FUNCTION_CODE_COUNT = CAN_FIELD_FUNCTION_CODE.max() + 1;
+
+// Le header C généré (can_id_layout.h) doit correspondre à can_id.h : sinon, relancer CAN_idgen
+static_assert(CAN_MASK_PRIORITY == CAN_FIELD_PRIORITY.mask() && CAN_MASK_EMIT_ADDR == CAN_FIELD_EMIT_ADDR.mask() &&
+              CAN_MASK_RECEIVER_ADDR == CAN_FIELD_RECEIVER_ADDR.mask() && CAN_MASK_FUNCTION_MODE == CAN_FIELD_FUNCTION_MODE.mask() &&
+              CAN_MASK_FUNCTION_CODE == CAN_FIELD_FUNCTION_CODE.mask() && CAN_MASK_MESSAGE_ID == CAN_FIELD_MESSAGE_ID.mask() &&
+              CAN_MASK_IS_RESPONSE == CAN_FIELD_IS_RESPONSE.mask(), "can_id_layout.h n'est pas à jour");
+
+// Les valeurs des énumérations doivent tenir dans leur champ
+static_assert(CANBUS_PRIO_INFO <= CAN_FIELD_PRIORITY.max());
+static_assert(CANBUS_BROADCAST <= CAN_FIELD_EMIT_ADDR.max() && CANBUS_BROADCAST <= CAN_FIELD_RECEIVER_ADDR.max());
+static_assert(MODE_COMPETITION <= CAN_FIELD_FUNCTION_MODE.max());
+static_assert(FCT_ERROR <= CAN_FIELD_FUNCTION_CODE.max() && FCT_COMPLETE <= CAN_FIELD_FUNCTION_CODE.max());
+
+// Comportement quand tous les ID message d'une destination sont utilisés (allocation automatique)
+enum can_id_policy_t {
+    CAN_ID_BLOCK,                                     // L'appelant attend qu'un ID se libère (jusqu'à l'échéance) ;
+                                                      // sendAsync et request se comportent comme avec CAN_ID_QUEUE
+    CAN_ID_FAIL,                                      // La requête échoue immédiatement (CAN_ERROR)
+    CAN_ID_QUEUE                                      // La requête est envoyée dès qu'un ID se libère
+};
+
+// Évolution de l'attente entre deux envois d'une même requête
+enum can_backoff_t {
+    CAN_BACKOFF_FIXED,                                // Même attente à chaque envoi
+    CAN_BACKOFF_EXPONENTIAL                           // Attente doublée à chaque envoi (jusqu'à maxTimeout)
+};
+
+/*!
+ * @brief Retransmission automatique d'une requête sans réponse
+ * @details La trame est renvoyée à l'identique (même ID message) : avec CAN::setResponseCache côté cible,
+ *          une requête reçue deux fois n'est exécutée qu'une fois
+ */
+struct can_retry_policy_t {
+    int retries{0};                                   // Nombre de renvois après le premier envoi
+    std::chrono::nanoseconds timeout{};               // Attente de la réponse au premier envoi
+    can_backoff_t backoff{CAN_BACKOFF_EXPONENTIAL};
+    std::chrono::nanoseconds maxTimeout{};            // Plafond de l'attente entre deux envois (0 => aucun)
+    std::chrono::nanoseconds deadline{};              // Durée totale maximale (0 => somme des attentes)
+    bool acknowledge{false};                          // La cible répond FCT_ACCUSER_RECEPTION dès la réception : plus de renvoi ensuite
+};
+
+// Requête en attente de réponse, complétée directement par le thread d'écoute
+struct can_pending_t {
+    canfd_frame buffer{};                             // Trame à envoyer, l'ID message est ajouté à l'allocation
+    uint8_t dest{};
+    uint16_t FunctionCode{};
+    uint8_t MessageID{};
+    uint64_t TxTimestamp{0};                          // Renseigné par l'écho de la trame (CAN_RAW_RECV_OWN_MSGS), CLOCK_REALTIME
+    bool registered{false};                           // Présente dans CAN::pending, son ID message est réservé
+
+    can_retry_policy_t retry;
+    int attempts{0};                                  // Renvois déjà effectués
+    std::chrono::nanoseconds attemptTimeout{};        // Attente après l'envoi en cours
+    std::chrono::steady_clock::time_point attemptDeadline; // Prochain renvoi (= deadline s'il n'y en a plus)
+    bool acknowledged{false};                         // FCT_ACCUSER_RECEPTION reçu : la cible traite la requête
+
+    can_result_t result{CAN_TIMEOUT};
+    bool done{false};                                 // Protégé par CAN::mutex
+    std::chrono::steady_clock::time_point deadline;
+    can_completion_t onComplete;                      // Vide pour les requêtes synchrones
+    std::condition_variable cv;
+};
+
+
+// Dernière requête reçue d'un émetteur avec un ID message donné, et sa réponse (CAN::setResponseCache)
+struct can_cached_response_t {
+    bool used{false};
+    bool answered{false};                             // false => callback en cours, ou pas encore de réponse
+    std::chrono::steady_clock::time_point time;       // Réception de la requête, puis envoi de la réponse
+    uint16_t FunctionCode{};
+    uint8_t Length{0};
+    uint8_t Data[CAN_MAX_DATA_LENGTH]{};              // Une requête aux données différentes n'est pas un doublon
+    canfd_frame response{};
+};
+
+typedef std::array<std::array<can_cached_response_t, CAN_MESSAGE_ID_COUNT>, CAN_ADDRESS_COUNT> can_response_cache_t;
+
+
+// État du contrôleur CAN, d'après les trames d'erreur (CAN_RAW_ERR_FILTER)
+enum can_bus_state_t {
+    CAN_STATE_ACTIVE,                                 // Fonctionnement normal
+    CAN_STATE_WARNING,                                // Compteur d'erreurs >= 96
+    CAN_STATE_PASSIVE,                                // Compteur d'erreurs >= 128 : le noeud ne signale plus les erreurs
+    CAN_STATE_BUS_OFF                                 // Compteur d'émission >= 256 : le noeud est déconnecté du bus
+};
+
+// Instantané des statistiques du bus renvoyé par CAN::stats()
+struct can_stats_t {
+    can_bus_state_t state{CAN_STATE_ACTIVE};
+    uint8_t txErrorCounter{0};                        // TEC / REC du contrôleur, si le driver les fournit
+    uint8_t rxErrorCounter{0};
+
+    uint64_t errorFrames{0};
+    uint64_t busOff{0};
+    uint64_t arbitrationLost{0};
+    uint64_t protocolErrors{0};                       // Erreurs de bit, de forme, de bourrage, de CRC...
+    uint64_t ackErrors{0};                            // Trame émise sans acquittement (aucun autre noeud ?)
+    uint64_t overflows{0};                            // Débordement des tampons du contrôleur
+
+    uint64_t rxFrames[CAN_ADDRESS_COUNT]{};           // Trames reçues, par émetteur
+    uint64_t rxReads{0};                              // Appels système de lecture (recvmsg ou recvmmsg, voir setBatchSize)
+    uint64_t timeouts[CAN_ADDRESS_COUNT]{};           // Requêtes sans réponse, par destination
+    uint64_t txErrors[CAN_ADDRESS_COUNT]{};           // Envois refusés par le noyau, par destination
+    uint64_t duplicateRequests{0};                    // Requêtes répétées non transmises aux callbacks (setResponseCache)
+
+    uint64_t retransmissions{0};                      // Renvois de requêtes sans réponse (can_retry_policy_t)
+    uint64_t acknowledgements{0};                     // FCT_ACCUSER_RECEPTION reçus pour des requêtes en attente
+    uint64_t recoveredRequests{0};                    // Requêtes abouties après au moins un renvoi
+    uint64_t exhaustedRequests{0};                    // Requêtes sans réponse malgré les renvois
+
+    uint64_t queueOverflows{0};                       // Trames perdues par la file de réception pleine (setReceiveQueue)
+
+    uint64_t txDropped{0};                            // Trames acceptées puis abandonnées par l'ordonnanceur (écrasées, erreur, arrêt)
+    uint64_t txExpired{0};                            // Trames restées en file d'émission au-delà de leur âge maximum (setTxQueue)
+    uint64_t txRejected{0};                           // Envois refusés par une file d'émission pleine (CAN_ERROR renvoyé)
+
+    double busLoad{0};                                // Occupation estimée du bus (0 à 1) depuis l'appel précédent
+};
+
+// Compteurs mis à jour par le thread d'écoute et les envois (relaxed : aucun ordre requis entre eux)
+struct can_counters_t {
+    std::atomic<can_bus_state_t> state{CAN_STATE_ACTIVE};
+    std::atomic<uint8_t> txErrorCounter{0};
+    std::atomic<uint8_t> rxErrorCounter{0};
+
+    std::atomic<uint64_t> errorFrames{0};
+    std::atomic<uint64_t> busOff{0};
+    std::atomic<uint64_t> arbitrationLost{0};
+    std::atomic<uint64_t> protocolErrors{0};
+    std::atomic<uint64_t> ackErrors{0};
+    std::atomic<uint64_t> overflows{0};
+
+    std::atomic<uint64_t> rxFrames[CAN_ADDRESS_COUNT]{};
+    std::atomic<uint64_t> rxReads{0};
+    std::atomic<uint64_t> timeouts[CAN_ADDRESS_COUNT]{};
+    std::atomic<uint64_t> txErrors[CAN_ADDRESS_COUNT]{};
+    std::atomic<uint64_t> duplicateRequests{0};
+
+    std::atomic<uint64_t> retransmissions{0};
+    std::atomic<uint64_t> acknowledgements{0};
+    std::atomic<uint64_t> recoveredRequests{0};
+    std::atomic<uint64_t> exhaustedRequests{0};
+
+    std::atomic<uint64_t> txDropped{0};               // Cumul des ordonnanceurs remplacés (setTxScheduler)
+    std::atomic<uint64_t> txExpired{0};
+    std::atomic<uint64_t> txRejected{0};
+};
+
+
+// Nombre maximum de trames lues par appel système en mode lot
+constexpr int CAN_MAX_BATCH = 64;
+
+// Trames traitées au plus par réveil : au-delà, retour à epoll_wait (toujours prêt, epoll n'est pas en EPOLLET)
+// pour expirer les requêtes, voir l'arrêt et laisser passer les autres bus d'une boucle partagée
+constexpr int CAN_MAX_DRAIN = 256;
+
+// Taille des données auxiliaires (horodatages) reçues avec chaque trame
+constexpr size_t CAN_CONTROL_SIZE = CMSG_SPACE(3 * sizeof(timespec)) + CMSG_SPACE(sizeof(timespec));
+
+// Tampons de réception préalloués, réutilisés à chaque réveil du thread d'écoute
+struct can_rx_ring_t {
+    alignas(64) canfd_frame buffers[CAN_MAX_BATCH];     // Classiques ou FD selon la taille lue (msg_len)
+    alignas(64) CanBus_FrameFormat frames[CAN_MAX_BATCH];
+    iovec iovecs[CAN_MAX_BATCH];
+    mmsghdr headers[CAN_MAX_BATCH];
+    alignas(cmsghdr) char controls[CAN_MAX_BATCH][CAN_CONTROL_SIZE];
 };
 
 
 class CAN {
+    friend class CanEventLoop;
 public:
-    int init(CanBus_Address address);
+    int init(CanBus_Address address, const std::string &interface = CAN_INTERFACE);
+    int init(CanBus_Address address, int fd);
     ~CAN();
 
     int startListening();
+    int startListening(CanEventLoop &loop);
+    int forward(uint16_t FunctionCode, CAN *target);
     void print(const CanBus_FrameFormat &frame);
-    void bind(uint16_t FunctionCode, can_callback_t callback);
+    int bind(uint16_t FunctionCode, can_callback_t callback);
+    template<uint16_t FunctionCode, typename Handler> requires can_has_schema<FunctionCode>
+    int on(Handler handler);
+    int setFunctionFilter(bool enabled);
+    int setBatchSize(int size);
+    int setTimestamps(bool enabled);
+    int setReceiveOwnMessages(bool enabled);
+    int setFdFrames(bool enabled, bool bitRateSwitch = true);
+    int setErrorMonitoring(bool enabled);
+    void setBitrate(uint32_t bitrate) { this->bitrate = bitrate; };
+    can_stats_t stats();
+    int setRecorder(CanRecorder *recorder);
+    int setResponseCache(std::chrono::milliseconds window);
     can_result_t send(
             CanBus_Priority priority,CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
             uint8_t MessageID, bool IsResp, int timeout = 0
     );
+    can_result_t send(
+            CanBus_Priority priority,CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+            uint8_t MessageID, bool IsResp, std::chrono::nanoseconds timeout
+    );
+    can_result_t send(
+            CanBus_Priority priority,CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+            uint8_t MessageID, bool IsResp, std::chrono::steady_clock::time_point deadline
+    );
+    can_result_t send(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+            std::chrono::nanoseconds timeout
+    );
+    can_result_t send(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+            const can_retry_policy_t &retry
+    );
+    can_result_t send(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, std::span<const uint8_t> data,
+            uint8_t MessageID, bool IsResp
+    );
+    template<size_t N>
+    can_result_t send(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::array<uint8_t, N> &data,
+            uint8_t MessageID, bool IsResp
+    ) {
+        static_assert(N <= CAN_MAX_DATA_LENGTH, "Un message CAN FD contient au maximum 64 octets");
+        return send(priority, dest, FunctionMode, FunctionCode, std::span<const uint8_t>(data), MessageID, IsResp);
+    }
+    template<uint16_t FunctionCode> requires can_has_schema<FunctionCode>
+    can_result_t send(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, const can_payload_t<FunctionCode> &payload,
+            uint8_t MessageID, bool IsResp
+    ) {
+        // Les données sont déjà dans leur format de transmission (can_schema.h) : simple copie dans la trame
+        auto bytes = std::span<const uint8_t>(reinterpret_cast<const uint8_t *>(&payload), sizeof(payload));
+        return send(priority, dest, FunctionMode, (CanBus_Fnct_Code) FunctionCode, bytes, MessageID, IsResp);
+    }
+    std::future<can_result_t> sendAsync(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+            uint8_t MessageID, std::chrono::nanoseconds timeout
+    );
+    std::future<can_result_t> sendAsync(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+            std::chrono::nanoseconds timeout
+    );
+    void sendAsync(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+            uint8_t MessageID, std::chrono::nanoseconds timeout, can_completion_t onComplete
+    );
+    void sendAsync(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+            std::chrono::nanoseconds timeout, can_completion_t onComplete
+    );
+    void sendAsync(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+            const can_retry_policy_t &retry, can_completion_t onComplete
+    );
+    can_result_t acknowledge(const CanBus_FrameFormat &frame);
+    template<typename Executor>
+    auto request(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+            uint8_t MessageID, std::chrono::steady_clock::time_point deadline, Executor &executor
+    );
+    template<typename Executor>
+    auto request(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+            std::chrono::steady_clock::time_point deadline, Executor &executor
+    );
+    void setIdPolicy(can_id_policy_t policy);
+    int setCallbackWorkers(int workers, size_t queueSize, can_shard_t shard, can_overflow_t overflow);
+    uint64_t droppedCallbacks() const { return dispatcher ? dispatcher->dropped() : 0; };
+    int setReceiveQueue(size_t size, can_overflow_t overflow);
+    size_t poll(std::span<CanBus_FrameFormat> frames);
+    bool tryReceive(CanBus_FrameFormat &frame);
+    int setTxScheduler(can_tx_mode_t mode, bool socketPriority = false);
+    int setTxQueue(CanBus_Priority priority, const can_tx_queue_t &queue);
+    void setFrameLogging(bool enabled);
+    std::vector<can_status_t> sendBatch(const std::vector<CanBus_FrameFormat> &frames);
 private:
-    int socket{};
+    int socket{-1};
+    int epollFd{-1};                                      // Instance epoll qui surveille le socket et eventFd
+    int eventFd{-1};                                      // Permet de réveiller le thread d'écoute (arrêt)
     CanBus_Address address{};
+    std::string interfaceName{CAN_INTERFACE};
+    bool canSocket{true};                                 // false => socket adopté (init(address, fd)), sans options CAN
     Logger logger{"CAN", "can.log"};
 
     std::mutex mutex;                                     // Mutex pour éviter les problèmes de concurrence
-    std::map<uint8_t, CanBus_FrameFormat> responses;
+    std::map<uint32_t, std::shared_ptr<can_pending_t>> pending; // Clé : (émetteur, code fonction, ID message)
+    std::chrono::steady_clock::time_point nextDeadline{std::chrono::steady_clock::time_point::max()};
+
+    can_id_policy_t idPolicy{CAN_ID_BLOCK};
+    uint8_t inFlight[CAN_ADDRESS_COUNT][CAN_MESSAGE_ID_COUNT]{}; // Requêtes en cours par (destination, ID message)
+    uint8_t nextId[CAN_ADDRESS_COUNT]{};                         // Prochain ID à essayer par destination
+    std::deque<std::shared_ptr<can_pending_t>> queued[CAN_ADDRESS_COUNT];
+    std::condition_variable idCv;                                // Réveille les requêtes en attente d'un ID (CAN_ID_BLOCK)
+    bool closing{false};                                         // Destruction en cours : plus aucune requête acceptée
+
+    can_counters_t counters;
+    uint32_t bitrate{CAN_DEFAULT_BITRATE};                // Débit nominal, pour estimer la charge du bus
+    std::mutex statsMutex;                                // Protège le dernier relevé des statistiques de l'interface
+    uint64_t lastBits{0};
+    std::chrono::steady_clock::time_point lastStats{};
+
+    CanRecorder *recorder{nullptr};                       // Copie brute de chaque trame reçue (nullptr = désactivé, fixé avant l'écoute)
+    std::unique_ptr<can_response_cache_t> responseCache;  // Réponses récentes par (émetteur, ID message), nullptr = désactivé
+    std::chrono::steady_clock::duration cacheWindow{};
+    std::mutex cacheMutex;
+    std::atomic<bool> logFrames{true};                    // Affichage de chaque trame envoyée/reçue (alloue via Logger)
+    bool filterFunctions{false};                          // Filtrage noyau sur les codes fonction liés (bind)
+    bool receiveOwn{false};                               // Écho de nos trames pour horodater les requêtes
+    bool hardwareTimestamps{false};                       // SIOCSHWTSTAMP accepté par le driver (setTimestamps)
+    bool fdFrames{false};                                 // CAN_RAW_FD_FRAMES : trames classiques et FD sur le socket
+    bool bitRateSwitch{true};                             // CANFD_BRS sur les trames FD envoyées
+    int batchSize{1};                                     // 1 => read(), sinon recvmmsg() par lots
+    std::unique_ptr<can_rx_ring_t> rxRing;
 
     std::atomic<bool> isListening{false};                 // Atomic pour éviter les problèmes de concurrence
-    std::map<uint8_t, can_callback_t> callbacks;
+    // Indexé directement par le code fonction. Remplacé par bind() pendant l'écoute : le thread qui exécute un callback
+    // en copie le pointeur (sous callbackMutex), l'ancien callback reste donc valide jusqu'à la fin de son appel
+    std::array<std::shared_ptr<const can_callback_t>, CAN_FUNCTION_CODE_COUNT> callbacks;
+    std::mutex callbackMutex;                                      // Protège la table, jamais tenu pendant un callback
+    std::mutex bindMutex;                                          // Sérialise bind() : boundCount et filtres noyau
+    std::array<CAN *, CAN_FUNCTION_CODE_COUNT> forwards{};         // Passerelle : bus vers lequel relayer chaque code fonction (fixé avant l'écoute)
+    int forwardCount{0};
+    int boundCount{0};
+    std::unique_ptr<CanDispatcher> dispatcher;                     // nullptr => callbacks dans le thread d'écoute
+    std::unique_ptr<CanRxQueue> rxQueue;                           // Non nul => trames lues par poll() au lieu des callbacks
+    std::unique_ptr<CanScheduler> scheduler;                       // nullptr => write() direct (CAN_TX_DIRECT)
+    std::array<can_tx_queue_t, CAN_PRIORITY_COUNT> txQueues{CAN_TX_QUEUES_DEFAULT};
     std::unique_ptr<std::thread> listenerThread{nullptr}; // unique_ptr pour pouvoir que la destruction soit automatique
+    CanEventLoop *eventLoop{nullptr};                      // Boucle partagée entre plusieurs interfaces (sinon listenerThread)
 
+    int setupEvents();
     void listen();
-    int readBuffer(CanBus_FrameFormat& frame, can_frame &buffer);
+    void drain();
+    void wake();
+    int receive();
+    int updateFilters();
+    void processFrame(const CanBus_FrameFormat &frame);
+    void dispatch(const CanBus_FrameFormat &frame);
+    bool replayResponse(const CanBus_FrameFormat &frame);
+    void cacheResponse(const canfd_frame &buffer);
+    void completeRequest(const CanBus_FrameFormat &frame);
+    bool acknowledgeRequest(const CanBus_FrameFormat &frame);
+    std::shared_ptr<can_pending_t> makeRetryRequest(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode,
+            std::span<const uint8_t> data, const can_retry_policy_t &retry
+    );
+    void confirmRequest(const canfd_frame &buffer, uint64_t timestamp);
+    void handleError(const canfd_frame &buffer);
+    uint64_t interfaceBits();
+    static uint64_t readTimestamp(const msghdr &header, uint64_t *hardware = nullptr);
+    std::shared_ptr<can_pending_t> makeRequest(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode,
+            std::span<const uint8_t> data, uint8_t MessageID, std::chrono::steady_clock::time_point deadline
+    );
+    int allocateId(uint8_t dest);
+    static void assignId(const std::shared_ptr<can_pending_t> &request, uint8_t MessageID);
+    void registerRequest(const std::shared_ptr<can_pending_t> &request);
+    void releaseRequest(const std::shared_ptr<can_pending_t> &request, std::vector<std::shared_ptr<can_pending_t>> &ready);
+    can_status_t submitRequest(const std::shared_ptr<can_pending_t> &request, bool allocate);
+    void launchRequests(const std::vector<std::shared_ptr<can_pending_t>> &ready);
+    void startAsync(const std::shared_ptr<can_pending_t> &request, bool allocate, can_completion_t onComplete);
+    can_result_t waitRequest(const std::shared_ptr<can_pending_t> &request);
+    void finishRequest(const std::shared_ptr<can_pending_t> &request, const can_result_t &result);
+    void expireRequests();
+    void failRequests();
+    int nextTimeout();
+    int transmit(const canfd_frame &buffer);
+    int buildFrame(
+            canfd_frame &buffer, CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode,
+            std::span<const uint8_t> data, uint8_t MessageID, bool IsResp, bool IsFD = false
+    );
+    static uint32_t pendingKey(uint8_t sender, uint16_t FunctionCode, uint8_t MessageID);
+    int readBuffer(CanBus_FrameFormat& frame, const canfd_frame &buffer, size_t size);
+    canid_t encodeId(uint8_t priority, uint8_t dest, uint8_t FunctionMode, uint16_t FunctionCode, uint8_t MessageID, bool IsResp) const;
 };
 
 
+/*!
+ * @brief Lie un callback typé à un code fonction : le type des données vient de son schéma (can_schema.h)
+ * @details handler(const Payload &) ou handler(CAN &, const CanBus_FrameFormat &, const Payload &) pour répondre.
+ *          Les données sont lues directement dans la trame ; une trame trop courte est ignorée
+ */
+template<uint16_t FunctionCode, typename Handler> requires can_has_schema<FunctionCode>
+int CAN::on(Handler handler) {
+    using Payload = can_payload_t<FunctionCode>;
+    constexpr bool withFrame = std::is_invocable_v<Handler &, CAN &, const CanBus_FrameFormat &, const Payload &>;
+    static_assert(withFrame || std::is_invocable_v<Handler &, const Payload &>,
+                  "Le callback doit accepter (const Payload &) ou (CAN &, const CanBus_FrameFormat &, const Payload &)");
+
+    return bind(FunctionCode, [handler = std::move(handler)](CAN &can, const CanBus_FrameFormat &frame) mutable {
+        const Payload *payload = canView<FunctionCode>(frame);
+        if (payload == nullptr) {
+            can.logger(WARNING) << "Trame trop courte pour le code fonction " << std::showbase << std::hex << FunctionCode << std::dec
+                                << " : " << (int) frame.Length << " octets au lieu de " << sizeof(Payload) << std::endl;
+            return;
+        }
+
+        if constexpr (withFrame)
+            handler(can, frame, *payload);
+        else
+            handler(*payload);
+    });
+}
+
+
+/*!
+ * @brief Awaitable renvoyé par CAN::request
+ * @details La requête est envoyée à la suspension de la coroutine, qui est reprise
+ *          via executor.post() quand le thread d'écoute complète la requête
+ */
+template<typename Executor>
+struct can_request_awaiter_t {
+    CAN &can;
+    Executor &executor;
+
+    CanBus_Priority priority;
+    CanBus_Address dest;
+    CanBus_Fnct_Mode FunctionMode;
+    CanBus_Fnct_Code FunctionCode;
+    std::vector<uint8_t> data;
+    int MessageID;                                    // -1 => alloué automatiquement
+    std::chrono::steady_clock::time_point deadline;
+
+    can_result_t result{CAN_ERROR};
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        // Même en cas d'erreur immédiate, la reprise passe par l'exécuteur
+        auto onComplete = [this, handle](const can_result_t &res) {
+            result = res;
+            executor.post([handle] { handle.resume(); });
+        };
+
+        auto timeout = deadline - std::chrono::steady_clock::now();
+        if (MessageID < 0)
+            can.sendAsync(priority, dest, FunctionMode, FunctionCode, data, timeout, onComplete);
+        else
+            can.sendAsync(priority, dest, FunctionMode, FunctionCode, data, (uint8_t) MessageID, timeout, onComplete);
+    }
+
+    can_result_t await_resume() const noexcept { return result; }
+};
+
+
+template<typename Executor>
+auto CAN::request(
+        CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+        uint8_t MessageID, std::chrono::steady_clock::time_point deadline, Executor &executor
+) {
+    return can_request_awaiter_t<Executor>{*this, executor, priority, dest, FunctionMode, FunctionCode, data, MessageID, deadline};
+}
+
+
+template<typename Executor>
+auto CAN::request(
+        CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &data,
+        std::chrono::steady_clock::time_point deadline, Executor &executor
+) {
+    return can_request_awaiter_t<Executor>{*this, executor, priority, dest, FunctionMode, FunctionCode, data, -1, deadline};
+}
+
+
 #endif //RASPI_CAN_H
@@ -0,0 +1,82 @@
+/*!
+ * @file can_bcm.h
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Header de la classe CanBcm
+ * @details Émission périodique et surveillance de flux périodiques via le Broadcast Manager (CAN_BCM) du noyau
+ */
+
+#ifndef RASPI_CAN_BCM_H
+#define RASPI_CAN_BCM_H
+
+#include <map>
+#include <span>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <linux/can.h>
+#include <robotech/logs.h>
+
+#include "can.h"
+
+
+// Appelé quand le contenu d'un flux surveillé change (CAN_OK) ou qu'il s'interrompt (CAN_TIMEOUT)
+typedef std::function<void(can_status_t status, const CanBus_FrameFormat &frame)> can_bcm_callback_t;
+
+
+/*!
+ * @brief Trames périodiques envoyées par le noyau, sans réveil du programme
+ * @details Une trame périodique est identifiée par (destination, code fonction),
+ *          un flux surveillé par (émetteur, code fonction)
+ */
+class CanBcm {
+public:
+    int init(CanBus_Address address, const std::string &interface = CAN_INTERFACE);
+    ~CanBcm();
+
+    int startPeriodic(
+            CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode,
+            std::span<const uint8_t> data, std::chrono::microseconds interval, uint32_t count = 0
+    );
+    int updatePeriodic(CanBus_Address dest, CanBus_Fnct_Code FunctionCode, std::span<const uint8_t> data);
+    int stopPeriodic(CanBus_Address dest, CanBus_Fnct_Code FunctionCode);
+
+    int watch(
+            CanBus_Priority priority, CanBus_Address sender, CanBus_Address receiver, CanBus_Fnct_Mode FunctionMode,
+            CanBus_Fnct_Code FunctionCode, std::chrono::microseconds timeout, can_bcm_callback_t callback
+    );
+    int unwatch(CanBus_Address sender, CanBus_Fnct_Code FunctionCode);
+private:
+    // Le noyau identifie une trame périodique par son ID et son type (CAN_FD_FRAME) : les mises à jour
+    // et la suppression doivent reprendre le type choisi au démarrage, quelle que soit la taille des données
+    struct periodic_t {
+        canid_t id;
+        uint32_t fd;                                  // CAN_FD_FRAME ou 0
+    };
+
+    int socket{-1};
+    int eventFd{-1};                                      // Réveille le thread de réception (arrêt)
+    CanBus_Address address{};
+    Logger logger{"CAN_BCM", "can.log"};
+
+    std::mutex mutex;
+    std::map<uint32_t, periodic_t> periodic;              // Clé : (destination, code fonction)
+    std::map<uint32_t, canid_t> watched;                  // Clé : (émetteur, code fonction)
+    std::map<canid_t, can_bcm_callback_t> callbacks;
+
+    std::atomic<bool> isListening{false};
+    std::unique_ptr<std::thread> listenerThread{nullptr};
+
+    void listen();
+    int setup(uint32_t opcode, uint32_t flags, canid_t id, std::span<const uint8_t> data, uint32_t count = 0,
+              std::chrono::microseconds interval1 = {}, std::chrono::microseconds interval2 = {});
+    static uint32_t key(uint8_t address, uint16_t FunctionCode);
+};
+
+
+#endif //RASPI_CAN_BCM_H
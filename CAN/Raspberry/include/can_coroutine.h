@@ -0,0 +1,58 @@
+/*!
+ * @file can_coroutine.h
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Header de l'exécuteur et du type de coroutine utilisés avec CAN::request
+ * @details Exemple : co_await can.request(..., deadline, executor) dans une fonction qui retourne CanTask
+ *          GCC 12 refuse une liste {...} temporaire comme données dans un co_await,
+ *          il faut passer par une variable std::vector<uint8_t>
+ */
+
+#ifndef RASPI_CAN_COROUTINE_H
+#define RASPI_CAN_COROUTINE_H
+
+#include <deque>
+#include <mutex>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+#include "can.h"
+
+
+/*!
+ * @brief Exécuteur mono-thread : les tâches postées (depuis n'importe quel thread)
+ *        sont exécutées dans le thread qui appelle run() ou runOnce()
+ */
+class CanExecutor {
+public:
+    void post(std::function<void()> task);
+
+    void run();
+    int runOnce();
+    void stop();
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> tasks;
+    bool stopped{false};
+};
+
+
+/*!
+ * @brief Coroutine détachée : elle démarre immédiatement et se détruit à la fin
+ */
+struct CanTask {
+    struct promise_type {
+        CanTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+
+#endif //RASPI_CAN_COROUTINE_H
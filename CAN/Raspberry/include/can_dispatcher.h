@@ -0,0 +1,84 @@
+/*!
+ * @file can_dispatcher.h
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Header de la classe CanDispatcher
+ * @details Pool de threads qui exécute les callbacks hors du thread d'écoute
+ */
+
+#ifndef RASPI_CAN_DISPATCHER_H
+#define RASPI_CAN_DISPATCHER_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include "define_can.h"
+
+
+// Répartition des trames entre les threads : l'ordre est conservé pour une même clé
+enum can_shard_t {
+    CAN_SHARD_FUNCTION_CODE,                          // Même code fonction => même thread
+    CAN_SHARD_SENDER                                  // Même émetteur => même thread
+};
+
+// Comportement quand une file bornée est pleine
+enum can_overflow_t {
+    CAN_OVERFLOW_BLOCK,                               // Le producteur attend qu'une place se libère (voir CanDispatcher::enterWait)
+    CAN_OVERFLOW_DROP_NEWEST,                         // La nouvelle trame est abandonnée
+    CAN_OVERFLOW_DROP_OLDEST                          // La plus ancienne trame de la file est écrasée
+};
+
+
+/*!
+ * @brief Exécute un handler sur un pool de threads, une file bornée par thread
+ * @details En CAN_OVERFLOW_BLOCK, un handler qui attend une réponse (send synchrone) dépend du thread d'écoute,
+ *          qui peut lui-même attendre dans post() : tant qu'un worker est dans enterWait() / leaveWait(),
+ *          post() abandonne la trame (comme CAN_OVERFLOW_DROP_NEWEST) au lieu d'attendre.
+ *          L'attente d'un std::future (sendAsync) n'est pas détectée : à éviter dans un handler avec BLOCK
+ */
+class CanDispatcher {
+public:
+    CanDispatcher(
+            int workers, size_t queueSize, can_shard_t shard, can_overflow_t overflow,
+            std::function<void(const CanBus_FrameFormat &frame)> handler
+    );
+    ~CanDispatcher();
+
+    void post(const CanBus_FrameFormat &frame);
+    bool isWorker() const { return current == this; };
+    void enterWait();
+    void leaveWait();
+    uint64_t dropped() const { return droppedFrames.load(std::memory_order_relaxed); };
+private:
+    struct worker_t {
+        std::mutex mutex;
+        std::condition_variable notEmpty;
+        std::condition_variable notFull;
+        std::vector<CanBus_FrameFormat> ring;         // Préalloué, aucune allocation par trame
+        size_t head{0};
+        size_t count{0};
+        std::thread thread;
+    };
+
+    can_shard_t shard;
+    can_overflow_t overflow;
+    std::function<void(const CanBus_FrameFormat &frame)> handler;
+
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> droppedFrames{0};
+    std::atomic<int> waiting{0};                      // Workers qui attendent le thread d'écoute (réponse, ID message)
+    std::vector<std::unique_ptr<worker_t>> workers;
+
+    static thread_local CanDispatcher *current;       // Pool du worker courant (nullptr hors des workers)
+
+    void run(worker_t &worker);
+};
+
+
+#endif //RASPI_CAN_DISPATCHER_H
@@ -0,0 +1,60 @@
+/*!
+ * @file can_event_loop.h
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Header de la classe CanEventLoop
+ * @details Un seul thread d'écoute pour plusieurs interfaces CAN
+ */
+
+#ifndef RASPI_CAN_EVENT_LOOP_H
+#define RASPI_CAN_EVENT_LOOP_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <robotech/logs.h>
+
+
+class CAN;
+
+
+/*!
+ * @brief Boucle epoll partagée : chaque CAN démarré avec startListening(loop) y ajoute son socket
+ * @details La boucle doit être détruite après les instances CAN qui l'utilisent.
+ *          Les callbacks sont exécutés dans son thread, comme avec startListening(), sans verrou de la boucle :
+ *          ils peuvent démarrer ou détruire un autre bus, mais pas détruire celui qui les appelle
+ */
+class CanEventLoop {
+    friend class CAN;
+public:
+    CanEventLoop();
+    ~CanEventLoop();
+
+    bool isReady() const { return ready; };
+    void wake();
+private:
+    int epollFd{-1};
+    int eventFd{-1};                                      // Réveil : arrêt, nouvelle échéance ou nouveau bus
+    bool ready{false};                                    // epoll et eventfd créés, thread démarré
+    Logger logger{"CAN_LOOP", "can.log"};
+
+    std::mutex mutex;                                     // Protège buses, generation et current (jamais tenu pendant un callback)
+    std::condition_variable idle;                         // Signalé quand la boucle a fini de traiter current
+    std::vector<CAN *> buses;
+    uint64_t generation{0};                               // Incrémenté à chaque retrait de bus
+    CAN *current{nullptr};                                // Bus en cours de traitement par le thread de la boucle
+    std::atomic<bool> running{true};
+    std::thread thread;
+
+    int add(CAN &can);
+    void remove(CAN &can);
+    void run();
+    bool enter(CAN *can, uint64_t snapshotGeneration);
+    void leave();
+};
+
+
+#endif //RASPI_CAN_EVENT_LOOP_H
@@ -0,0 +1,108 @@
+/*!
+ * @file can_id.h
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Disposition des champs de l'identifiant CAN (29 bits) et encodage / décodage
+ * @details Seule définition de la disposition : can_id_layout.h (C, utilisé par les cartes STM32)
+ *          est généré à partir de ce fichier par CAN_idgen, et la compilation vérifie qu'il est à jour
+ */
+
+#ifndef RASPI_CAN_ID_H
+#define RASPI_CAN_ID_H
+
+#include <cstdint>
+
+
+// Nombre de bits d'un identifiant étendu
+constexpr int CAN_ID_BITS = 29;
+
+// Un champ de l'identifiant : position de son bit de poids faible et nombre de bits
+struct can_id_field_t {
+    const char *name;                                 // Suffixe des macros C (CAN_OFFSET_<name>, CAN_MASK_<name>...)
+    uint8_t offset;
+    uint8_t width;
+
+    [[nodiscard]] constexpr uint32_t max() const { return (1u << width) - 1; }
+    [[nodiscard]] constexpr uint32_t mask() const { return max() << offset; }
+
+    // La valeur est tronquée à la largeur du champ : elle ne peut pas déborder sur ses voisins
+    [[nodiscard]] constexpr uint32_t encode(uint32_t value) const { return (value & max()) << offset; }
+    [[nodiscard]] constexpr uint32_t decode(uint32_t id) const { return (id >> offset) & max(); }
+};
+
+// Des bits de poids fort aux bits de poids faible
+constexpr can_id_field_t CAN_FIELD_PRIORITY      {"PRIORITY",      27, 2};
+constexpr can_id_field_t CAN_FIELD_EMIT_ADDR     {"EMIT_ADDR",     23, 4};
+constexpr can_id_field_t CAN_FIELD_RECEIVER_ADDR {"RECEIVER_ADDR", 19, 4};
+constexpr can_id_field_t CAN_FIELD_FUNCTION_MODE {"FUNCTION_MODE", 15, 4};
+constexpr can_id_field_t CAN_FIELD_FUNCTION_CODE {"FUNCTION_CODE",  5, 10};
+constexpr can_id_field_t CAN_FIELD_MESSAGE_ID    {"MESSAGE_ID",     1, 4};
+constexpr can_id_field_t CAN_FIELD_IS_RESPONSE   {"IS_RESPONSE",    0, 1};
+
+constexpr can_id_field_t CAN_ID_FIELDS[] = {
+    CAN_FIELD_PRIORITY, CAN_FIELD_EMIT_ADDR, CAN_FIELD_RECEIVER_ADDR, CAN_FIELD_FUNCTION_MODE,
+    CAN_FIELD_FUNCTION_CODE, CAN_FIELD_MESSAGE_ID, CAN_FIELD_IS_RESPONSE
+};
+
+
+// Les champs se suivent sans trou ni chevauchement et couvrent exactement les 29 bits
+constexpr bool canIdLayoutValid() {
+    int next = CAN_ID_BITS;
+    for (const can_id_field_t &field : CAN_ID_FIELDS) {
+        if (field.width == 0 || field.offset + field.width != next)
+            return false;
+        next = field.offset;
+    }
+    return next == 0;
+}
+
+static_assert(canIdLayoutValid(), "Les champs de l'identifiant CAN doivent couvrir les 29 bits sans chevauchement");
+
+
+// Champs d'un identifiant décodé
+struct can_id_fields_t {
+    uint8_t Priority;
+    uint8_t SenderAddress;
+    uint8_t ReceiverAddress;
+    uint8_t FunctionMode;
+    uint16_t FunctionCode;
+    uint8_t MessageID;
+    bool IsResp;
+};
+
+
+// Sans CAN_EFF_FLAG : il est propre à SocketCAN (IDE = CAN_ID_EXT côté STM32)
+constexpr uint32_t canIdEncode(
+        uint8_t Priority, uint8_t sender, uint8_t receiver, uint8_t FunctionMode, uint16_t FunctionCode,
+        uint8_t MessageID = 0, bool IsResp = false
+) {
+    return CAN_FIELD_PRIORITY.encode(Priority)          |
+           CAN_FIELD_EMIT_ADDR.encode(sender)           |
+           CAN_FIELD_RECEIVER_ADDR.encode(receiver)     |
+           CAN_FIELD_FUNCTION_MODE.encode(FunctionMode) |
+           CAN_FIELD_FUNCTION_CODE.encode(FunctionCode) |
+           CAN_FIELD_MESSAGE_ID.encode(MessageID)       |
+           CAN_FIELD_IS_RESPONSE.encode(IsResp);
+}
+
+
+constexpr can_id_fields_t canIdDecode(uint32_t id) {
+    return {
+        (uint8_t) CAN_FIELD_PRIORITY.decode(id),
+        (uint8_t) CAN_FIELD_EMIT_ADDR.decode(id),
+        (uint8_t) CAN_FIELD_RECEIVER_ADDR.decode(id),
+        (uint8_t) CAN_FIELD_FUNCTION_MODE.decode(id),
+        (uint16_t) CAN_FIELD_FUNCTION_CODE.decode(id),
+        (uint8_t) CAN_FIELD_MESSAGE_ID.decode(id),
+        (bool) CAN_FIELD_IS_RESPONSE.decode(id)
+    };
+}
+
+
+static_assert(canIdDecode(canIdEncode(3, 0xF, 0x1, 0x9, 0x3FF, 0xA, true)).FunctionCode == 0x3FF);
+static_assert(canIdDecode(canIdEncode(3, 0xF, 0x1, 0x9, 0x3FF, 0xA, true)).FunctionMode == 0x9);
+static_assert(canIdEncode(0, 0, 0, 0, 0x400) == 0, "Un code fonction hors limites ne doit pas déborder sur le mode");
+
+
+#endif //RASPI_CAN_ID_H
@@ -0,0 +1,58 @@
+/*!
+ * @file can_id_layout.h
+ * @brief Disposition des champs de l'identifiant CAN (29 bits), utilisable en C
+ * @details Fichier généré par CAN_idgen à partir de can_id.h : ne pas modifier à la main
+ */
+
+#ifndef CAN_ID_LAYOUT_H
+#define CAN_ID_LAYOUT_H
+
+#ifdef __cplusplus
+#include <cstdint>
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#endif
+
+#define CAN_OFFSET_PRIORITY         27
+#define CAN_OFFSET_EMIT_ADDR        23
+#define CAN_OFFSET_RECEIVER_ADDR    19
+#define CAN_OFFSET_FUNCTION_MODE    15
+#define CAN_OFFSET_FUNCTION_CODE    5
+#define CAN_OFFSET_MESSAGE_ID       1
+#define CAN_OFFSET_IS_RESPONSE      0
+
+#define CAN_WIDTH_PRIORITY          2
+#define CAN_WIDTH_EMIT_ADDR         4
+#define CAN_WIDTH_RECEIVER_ADDR     4
+#define CAN_WIDTH_FUNCTION_MODE     4
+#define CAN_WIDTH_FUNCTION_CODE     10
+#define CAN_WIDTH_MESSAGE_ID        4
+#define CAN_WIDTH_IS_RESPONSE       1
+
+#define CAN_MASK_PRIORITY           0x18000000u
+#define CAN_MASK_EMIT_ADDR          0x07800000u
+#define CAN_MASK_RECEIVER_ADDR      0x00780000u
+#define CAN_MASK_FUNCTION_MODE      0x00078000u
+#define CAN_MASK_FUNCTION_CODE      0x00007FE0u
+#define CAN_MASK_MESSAGE_ID         0x0000001Eu
+#define CAN_MASK_IS_RESPONSE        0x00000001u
+
+// Extraction d'un champ, par exemple CAN_ID_GET(id, FUNCTION_CODE)
+#define CAN_ID_GET(id, field) (((uint32_t) (id) & CAN_MASK_##field) >> CAN_OFFSET_##field)
+
+// Identifiant sans le bit d'identifiant étendu (CAN_EFF_FLAG / IDE), chaque valeur est tronquée à son champ
+static inline uint32_t can_id_encode(
+        uint8_t priority, uint8_t sender, uint8_t receiver, uint8_t function_mode, uint16_t function_code,
+        uint8_t message_id, bool is_response
+) {
+    return ((uint32_t) priority & 0x00000003u) << 27 |
+           ((uint32_t) sender & 0x0000000Fu) << 23 |
+           ((uint32_t) receiver & 0x0000000Fu) << 19 |
+           ((uint32_t) function_mode & 0x0000000Fu) << 15 |
+           ((uint32_t) function_code & 0x000003FFu) << 5 |
+           ((uint32_t) message_id & 0x0000000Fu) << 1 |
+           ((uint32_t) is_response & 0x00000001u) << 0;
+}
+
+#endif /* CAN_ID_LAYOUT_H */
@@ -0,0 +1,56 @@
+/*!
+ * @file can_isotp.h
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Header de la classe CanIsoTp
+ * @details Transport segmenté ISO 15765-2 (ISO-TP) au-dessus des sockets CAN_ISOTP du noyau
+ */
+
+#ifndef RASPI_CAN_ISOTP_H
+#define RASPI_CAN_ISOTP_H
+
+#include <span>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <sys/types.h>
+#include <robotech/logs.h>
+
+#include "define_can.h"
+#include "can_id.h"
+
+
+// Paramètres du contrôle de flux d'un canal ISO-TP
+struct can_isotp_config_t {
+    uint8_t blockSize{0};                             // Trames consécutives entre deux contrôles de flux (0 = sans limite)
+    uint8_t stMin{0};                                 // Écart demandé entre trames consécutives (0x00-0x7F : ms, 0xF1-0xF9 : 100-900 µs)
+    bool fd{false};                                   // Trames CAN FD (64 octets) au lieu de trames classiques
+    bool padding{false};                              // Trames complétées à 8 octets avec 0xCC
+};
+
+
+/*!
+ * @brief Canal ISO-TP point à point entre notre adresse et dest, pour un code fonction
+ * @details Les identifiants suivent le format 29 bits habituel (ID message et IsResp à 0).
+ *          Le code fonction ne doit pas être lié sur l'instance CAN, et celle-ci doit utiliser
+ *          setFunctionFilter(true) pour ne pas recevoir les trames segmentées.
+ */
+class CanIsoTp {
+public:
+    int init(
+            CanBus_Address address, CanBus_Address dest, CanBus_Fnct_Code FunctionCode, const can_isotp_config_t &config = {},
+            CanBus_Priority priority = CANBUS_PRIO_LOW, CanBus_Fnct_Mode FunctionMode = MODE_DEBUG,
+            const std::string &interface = CAN_INTERFACE
+    );
+    ~CanIsoTp();
+
+    int send(std::span<const uint8_t> data);
+    ssize_t receive(std::span<uint8_t> buffer, std::chrono::milliseconds timeout);
+private:
+    int socket{-1};
+    Logger logger{"CAN_ISOTP", "can.log"};
+};
+
+
+#endif //RASPI_CAN_ISOTP_H
@@ -0,0 +1,63 @@
+/*!
+ * @file can_queue.h
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Header de la classe CanRxQueue
+ * @details File de réception sans verrou (un producteur : le thread d'écoute, un consommateur : la boucle de contrôle)
+ */
+
+#ifndef RASPI_CAN_QUEUE_H
+#define RASPI_CAN_QUEUE_H
+
+#include <span>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#include "define_can.h"
+#include "can_dispatcher.h"
+
+
+// Une trame est recopiée mot par mot (atomic_ref) : mots de 32 bits, sans verrou aussi sur un Raspberry Pi OS 32 bits
+constexpr size_t CAN_QUEUE_WORDS = (sizeof(CanBus_FrameFormat) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+/*!
+ * @brief File circulaire bornée SPSC, préallouée : ni verrou ni allocation par trame
+ * @details En CAN_OVERFLOW_DROP_OLDEST, le producteur avance lui-même la tête de la file (CAS) et peut réécrire
+ *          la place que le consommateur est en train de lire. Chaque place a donc un compteur de séquence (seqlock)
+ *          et son contenu n'est accédé que par des opérations atomiques : le consommateur détecte une copie
+ *          incohérente grâce à la séquence, et une trame déjà écrasée grâce à un CAS sur la tête
+ */
+class CanRxQueue {
+public:
+    CanRxQueue(size_t size, can_overflow_t overflow);
+
+    bool push(const CanBus_FrameFormat &frame);
+    bool pop(CanBus_FrameFormat &frame);
+    size_t pop(std::span<CanBus_FrameFormat> frames);
+
+    uint64_t dropped() const { return droppedFrames.load(std::memory_order_relaxed); };
+private:
+    struct slot_t {
+        std::atomic<uint32_t> sequence{0};            // Impair pendant l'écriture
+        uint32_t words[CAN_QUEUE_WORDS]{};            // Accédés uniquement via std::atomic_ref
+    };
+
+    size_t size;                                      // Puissance de 2 : index = compteur & mask
+    size_t mask;
+    can_overflow_t overflow;
+    std::unique_ptr<slot_t[]> ring;
+
+    // Compteurs croissants, sur des lignes de cache séparées (pas de faux partage entre les deux threads)
+    alignas(64) std::atomic<size_t> head{0};          // Prochaine trame à lire
+    alignas(64) std::atomic<size_t> tail{0};          // Prochaine place à écrire (producteur seul)
+    alignas(64) std::atomic<uint64_t> droppedFrames{0};
+
+    static void store(slot_t &slot, const CanBus_FrameFormat &frame);
+    static bool load(const slot_t &slot, CanBus_FrameFormat &frame);
+};
+
+
+#endif //RASPI_CAN_QUEUE_H
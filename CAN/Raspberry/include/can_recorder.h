@@ -0,0 +1,102 @@
+/*!
+ * @file can_recorder.h
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Header des classes CanRecorder et CanRecordReader
+ * @details Enregistrement des trames brutes dans un fichier binaire projeté en mémoire (mmap), en ajout seul
+ */
+
+#ifndef RASPI_CAN_RECORDER_H
+#define RASPI_CAN_RECORDER_H
+
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <linux/can.h>
+#include <robotech/logs.h>
+
+
+// Le fichier est agrandi et projeté par fenêtres de cette taille : la mémoire utilisée ne dépend pas de la durée
+constexpr uint32_t CAN_RECORD_CHUNK = 64 << 20;
+
+// En-tête du fichier (début de la première fenêtre)
+struct can_record_file_t {
+    char magic[8];                                    // "CANREC01"
+    uint32_t version;
+    uint32_t chunkSize;                               // Aucun enregistrement ne chevauche deux fenêtres
+};
+
+// Version écrite par CanRecorder (CanRecordReader lit aussi la version 1, sans Monotonic)
+constexpr uint32_t CAN_RECORD_VERSION = 2;
+
+// En-tête d'un enregistrement, suivi de len octets de données (taille totale alignée sur 8 octets)
+struct can_record_t {
+    uint64_t Timestamp;                               // ns, CLOCK_REALTIME (horodatage noyau si activé) : date de réception
+    uint64_t Monotonic;                               // ns, même instant en CLOCK_MONOTONIC : insensible aux réglages de l'heure (NTP)
+    uint32_t can_id;                                  // Identifiant brut, avec CAN_EFF_FLAG / CAN_ERR_FLAG
+    uint8_t len;
+    uint8_t flags;                                    // Flags canfd_frame, CANFD_FDF pour les trames FD
+    uint16_t size;                                    // 0 => fin de la fenêtre (ou du fichier)
+
+    const uint8_t *data() const { return (const uint8_t *) (this + 1); }
+};
+
+
+/*!
+ * @brief Ajoute les trames reçues à un fichier, sans appel système ni formatage par trame
+ * @details Voir CAN::setRecorder. Un appel système n'a lieu qu'au changement de fenêtre (CAN_RECORD_CHUNK)
+ */
+class CanRecorder {
+public:
+    int open(const std::string &path, uint32_t chunkSize = CAN_RECORD_CHUNK);
+    void close();
+    ~CanRecorder();
+
+    void append(const canfd_frame &buffer, size_t size, uint64_t timestamp);  // timestamp : CLOCK_REALTIME, 0 => heure courante
+private:
+    int fd{-1};
+    uint8_t *map{nullptr};                            // Fenêtre courante du fichier
+    uint64_t mapOffset{0};                            // Position de la fenêtre dans le fichier
+    uint32_t position{0};                             // Position d'écriture dans la fenêtre
+    uint32_t chunkSize{CAN_RECORD_CHUNK};
+
+    std::mutex mutex;                                 // Plusieurs bus peuvent partager un enregistreur
+    Logger logger{"CAN_REC", "can.log"};
+
+    int mapChunk();
+};
+
+
+/*!
+ * @brief Lecture séquentielle d'un enregistrement, fenêtre par fenêtre
+ * @details Une seule fenêtre est projetée à la fois : l'espace d'adressage utilisé ne dépend pas de la taille
+ *          du fichier (un long enregistrement ne tiendrait pas d'un bloc sur un Raspberry Pi OS 32 bits)
+ */
+class CanRecordReader {
+public:
+    int open(const std::string &path);
+    ~CanRecordReader();
+
+    const can_record_t *next();
+    uint32_t version() const { return fileVersion; };
+private:
+    int fd{-1};
+    const uint8_t *map{nullptr};                      // Fenêtre courante du fichier
+    uint64_t mapOffset{0};                            // Position de la fenêtre dans le fichier
+    uint32_t mapSize{0};                              // Taille projetée (la dernière fenêtre peut être plus courte)
+    uint64_t fileSize{0};
+    uint64_t offset{0};                               // Position de lecture dans le fichier
+    uint32_t chunkSize{CAN_RECORD_CHUNK};
+    uint32_t fileVersion{CAN_RECORD_VERSION};
+
+    // Version 1 : l'enregistrement est converti ici (Monotonic = 0)
+    alignas(can_record_t) uint8_t converted[sizeof(can_record_t) + CANFD_MAX_DLEN];
+
+    int mapChunk(uint64_t chunk);
+
+    Logger logger{"CAN_REC", "can.log"};
+};
+
+
+#endif //RASPI_CAN_RECORDER_H
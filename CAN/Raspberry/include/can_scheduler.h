@@ -0,0 +1,137 @@
+/*!
+ * @file can_scheduler.h
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Header de la classe CanScheduler
+ * @details Étage d'émission avec une file par CanBus_Priority
+ */
+
+#ifndef RASPI_CAN_SCHEDULER_H
+#define RASPI_CAN_SCHEDULER_H
+
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <linux/can.h>
+#include <condition_variable>
+#include <robotech/logs.h>
+
+#include "define_can.h"
+#include "can_id.h"
+#include "can_dispatcher.h"
+
+
+// Nombre de niveaux de priorité (champ de 2 bits)
+constexpr int CAN_PRIORITY_COUNT = CAN_FIELD_PRIORITY.max() + 1;
+
+// Taille à écrire sur le socket : les trames classiques sont aussi stockées dans un canfd_frame,
+// seules celles marquées CANFD_FDF sont envoyées en CAN FD
+inline size_t canMtu(const canfd_frame &buffer) {
+    return buffer.flags & CANFD_FDF ? CANFD_MTU : CAN_MTU;
+}
+
+// Ordonnancement des files d'émission
+enum can_tx_mode_t {
+    CAN_TX_DIRECT,                                    // Pas de file, write() direct depuis le thread appelant
+    CAN_TX_STRICT,                                    // Une file n'est servie que si les plus prioritaires sont vides
+    CAN_TX_WEIGHTED                                   // Tourniquet pondéré (poids par priorité)
+};
+
+/*!
+ * @brief File d'émission d'une priorité
+ * @details Bus saturé ou en bus-off : les écritures échouent (ENOBUFS) et la file se remplit. Sa taille et l'âge
+ *          maximum des trames évitent d'envoyer d'un coup des consignes périmées quand le bus redevient disponible
+ */
+struct can_tx_queue_t {
+    size_t size;                                      // Trames au maximum dans la file
+    can_overflow_t overflow;                          // File pleine : CAN_OVERFLOW_DROP_* (BLOCK refusé, voir CAN::setTxQueue)
+    std::chrono::nanoseconds maxAge;                  // Trame abandonnée si elle n'est pas partie à temps (0 => aucun âge maximum)
+};
+
+// SO_SNDBUF du socket tant que l'ordonnanceur l'utilise : 0 => minimum du noyau (quelques trames).
+// Les trames attendent dans les files de l'ordonnanceur plutôt que dans celle du noyau, la priorité est choisie au dernier moment
+constexpr int CAN_TX_SEND_BUFFER = 0;
+
+// Attente après un refus du noyau (ENOBUFS), doublée à chaque nouvel échec jusqu'à CAN_TX_BUSY_TIMEOUT
+constexpr std::chrono::microseconds CAN_TX_RETRY_DELAY{100};
+
+// Une consigne urgente refusée est signalée à l'appelant (CAN_ERROR), une information périmée est remplacée par la suivante
+constexpr std::array<can_tx_queue_t, CAN_PRIORITY_COUNT> CAN_TX_QUEUES_DEFAULT = {{
+    {64, CAN_OVERFLOW_DROP_NEWEST, std::chrono::milliseconds(100)},    // CANBUS_PRIO_HIGH
+    {64, CAN_OVERFLOW_DROP_NEWEST, std::chrono::milliseconds(100)},    // CANBUS_PRIO_STD
+    {32, CAN_OVERFLOW_DROP_OLDEST, std::chrono::milliseconds(100)},    // CANBUS_PRIO_LOW
+    {16, CAN_OVERFLOW_DROP_OLDEST, std::chrono::milliseconds(100)}     // CANBUS_PRIO_INFO
+}};
+
+
+/*!
+ * @brief Thread d'émission : choisit la prochaine trame selon sa priorité
+ *        et attend (POLLOUT) quand la file du noyau est pleine au lieu d'abandonner la trame
+ * @details La file du noyau est réduite à quelques trames (CAN_TX_SEND_BUFFER) : sinon, une fois remplie de trames
+ *          CANBUS_PRIO_INFO, une trame CANBUS_PRIO_HIGH attendrait derrière elles. SO_SNDBUF est rétabli par stop()
+ */
+class CanScheduler {
+public:
+    CanScheduler(
+            int socket, can_tx_mode_t mode, bool socketPriority,
+            const std::array<can_tx_queue_t, CAN_PRIORITY_COUNT> &config = CAN_TX_QUEUES_DEFAULT,
+            std::atomic<uint64_t> *txErrors = nullptr,
+            std::array<int, CAN_PRIORITY_COUNT> weights = {8, 4, 2, 1}
+    );
+    ~CanScheduler();
+
+    bool push(const canfd_frame &buffer);
+    void stop();
+    void setFrameLogging(bool enabled) { logFrames = enabled; };
+    uint64_t dropped() const { return droppedFrames.load(std::memory_order_relaxed); };
+    uint64_t expired() const { return expiredFrames.load(std::memory_order_relaxed); };
+    uint64_t rejected() const { return rejectedFrames.load(std::memory_order_relaxed); };
+private:
+    struct entry_t {
+        canfd_frame buffer;
+        std::chrono::steady_clock::time_point time;   // Mise en file, pour l'âge maximum
+    };
+
+    struct queue_t {
+        can_tx_queue_t config;
+        std::vector<entry_t> ring;                    // Préalloué, aucune allocation par trame
+        size_t head{0};
+        size_t count{0};
+    };
+
+    int socket;
+    can_tx_mode_t mode;
+    bool socketPriority;                              // Applique SO_PRIORITY pour les bandes de pfifo_fast
+    std::array<int, CAN_PRIORITY_COUNT> weights;
+    std::array<int, CAN_PRIORITY_COUNT> credits{};
+    int currentPriority{-1};                          // Dernier SO_PRIORITY appliqué
+    int sendBuffer{-1};                               // SO_SNDBUF d'origine, rétabli à l'arrêt (-1 => inchangé)
+    std::atomic<uint64_t> *txErrors;                  // Refus du noyau par destination (compteurs de CAN, CAN_ADDRESS_COUNT cases)
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::array<queue_t, CAN_PRIORITY_COUNT> queues;
+    int writing{-1};                                  // Priorité de la trame en cours d'écriture (tête de sa file)
+    bool stopping{false};
+
+    std::atomic<uint64_t> droppedFrames{0};           // Trames acceptées puis perdues : écrasées (DROP_OLDEST), erreur d'écriture, arrêt
+    std::atomic<uint64_t> expiredFrames{0};           // Âge maximum dépassé
+    std::atomic<uint64_t> rejectedFrames{0};          // Refusées par une file pleine (DROP_NEWEST) : push() renvoie false
+
+    std::atomic<bool> logFrames{true};
+    Logger logger{"CAN_TX", "can.log"};
+    std::thread thread;
+
+    void run();
+    int select();
+    void pop(int priority);
+    int write(const canfd_frame &buffer);
+    void fail(const canfd_frame &buffer, int error);
+};
+
+
+#endif //RASPI_CAN_SCHEDULER_H
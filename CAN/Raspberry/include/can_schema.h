@@ -0,0 +1,118 @@
+/*!
+ * @file can_schema.h
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Schémas des données associées à chaque code fonction
+ * @details Chaque code fonction déclare une seule fois la structure de ses données (ordre des octets compris),
+ *          puis CAN::on et CAN::send l'utilisent directement sur le buffer de la trame, sans copie ni décodage à la main
+ */
+
+#ifndef RASPI_CAN_SCHEMA_H
+#define RASPI_CAN_SCHEMA_H
+
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+#include "define_can.h"
+
+
+// Entier non signé de N octets (pour la conversion d'un champ)
+template<size_t N>
+using can_uint_t = std::conditional_t<N == 1, uint8_t, std::conditional_t<N == 2, uint16_t, std::conditional_t<N == 4, uint32_t, uint64_t>>>;
+
+/*!
+ * @brief Champ de N octets avec un ordre des octets fixé, quel que soit le processeur
+ * @details Stocké comme un tableau d'octets : alignement de 1, donc aucun bourrage dans les structures de données
+ */
+template<typename T, bool BigEndian>
+struct can_field_t {
+    static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>, "Un champ contient un entier, un flottant ou une énumération");
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+
+    uint8_t bytes[sizeof(T)];
+
+    can_field_t() = default;
+    constexpr can_field_t(T value) { *this = value; }
+
+    // Le compilateur réduit ces boucles à un simple chargement (et un bswap si l'ordre diffère du processeur)
+    constexpr operator T() const {
+        can_uint_t<sizeof(T)> raw = 0;
+        for (size_t i = 0; i < sizeof(T); i++)
+            raw |= (can_uint_t<sizeof(T)>) bytes[BigEndian ? sizeof(T) - 1 - i : i] << (8 * i);
+        return std::bit_cast<T>(raw);
+    }
+
+    constexpr can_field_t &operator=(T value) {
+        auto raw = std::bit_cast<can_uint_t<sizeof(T)>>(value);
+        for (size_t i = 0; i < sizeof(T); i++)
+            bytes[BigEndian ? sizeof(T) - 1 - i : i] = (uint8_t) (raw >> (8 * i));
+        return *this;
+    }
+};
+
+// Petit boutiste : ordre natif du Raspberry et des STM32, à utiliser par défaut
+template<typename T>
+using can_le = can_field_t<T, false>;
+
+template<typename T>
+using can_be = can_field_t<T, true>;
+
+
+// Données utilisables directement sur le buffer d'une trame : octets uniquement, sans bourrage, tenant dans une trame
+template<typename T>
+concept can_payload = std::is_trivially_copyable_v<T> && alignof(T) == 1 && sizeof(T) <= CAN_MAX_DATA_LENGTH;
+
+// Schéma d'un code fonction : à spécialiser (voir plus bas), aucun type par défaut
+template<uint16_t FunctionCode>
+struct can_schema_t {};
+
+template<uint16_t FunctionCode>
+concept can_has_schema = requires { typename can_schema_t<FunctionCode>::type; };
+
+template<uint16_t FunctionCode> requires can_has_schema<FunctionCode>
+using can_payload_t = typename can_schema_t<FunctionCode>::type;
+
+
+/*!
+ * @brief Vue sur les données d'une trame, sans copie
+ * @return nullptr si la trame n'a pas ce code fonction ou est trop courte.
+ *         Une trame plus longue est acceptée (bourrage CAN FD, champs ajoutés en fin de structure)
+ */
+template<uint16_t FunctionCode>
+const can_payload_t<FunctionCode> *canView(const CanBus_FrameFormat &frame) {
+    if (frame.FunctionCode != FunctionCode || frame.Length < sizeof(can_payload_t<FunctionCode>))
+        return nullptr;
+
+    // Valide car le type ne contient que des octets (alignement de 1, voir can_payload)
+    return reinterpret_cast<const can_payload_t<FunctionCode> *>(frame.Data);
+}
+
+
+// Déclare la structure des données d'un code fonction et vérifie qu'elle est utilisable sur une trame
+#define CAN_SCHEMA(FunctionCode, Payload)                                                              \
+    template<> struct can_schema_t<FunctionCode> { using type = Payload; };                           \
+    static_assert(can_payload<Payload>, #Payload " doit être composé d'octets et tenir dans une trame")
+
+
+/*********************************************** Schémas ***********************************************/
+
+// Uniquement les formats fixés par les cartes (voir CAN/L432) : un schéma déclaré ici devient la référence.
+// FCT_DPL_TRIANGLE et FCT_DPL_AVANCE attendent le format de la base roulante, d'ici là bind() / send() bruts
+
+// Valeurs de AccuserReception::Status
+enum can_ack_t : uint8_t {
+    CAN_NACK = 0x00,
+    CAN_ACK  = 0x01
+};
+
+struct AccuserReception {
+    can_ack_t Status;
+};
+
+CAN_SCHEMA(FCT_ACCUSER_RECEPTION, AccuserReception);
+
+
+#endif //RASPI_CAN_SCHEMA_H
@@ -20,24 +20,20 @@
 #include <stdbool.h>
 #endif
 
-// Interface à utiliser (vcan0 ou can0)
+// Interface utilisée par défaut (vcan0 ou can0), voir CAN::init
 #define CAN_INTERFACE "can0"
 
-// Masques et décalages pour extraire les informations d'un message CAN
-#define CAN_MASK_PRIORITY       0b11000000000000000000000000000
-#define CAN_MASK_EMIT_ADDR      0b00111100000000000000000000000
-#define CAN_MASK_RECEIVER_ADDR  0b00000011110000000000000000000
-#define CAN_MASK_FUNCTION_MODE  0b00000000001111000000000000000
-#define CAN_MASK_FUNCTION_CODE  0b00000000000000111111111100000
-#define CAN_MASK_MESSAGE_ID     0b00000000000000000000000011110
-#define CAN_MASK_IS_RESPONSE    0b00000000000000000000000000001
-
-#define CAN_OFFSET_PRIORITY       27
-#define CAN_OFFSET_EMIT_ADDR      23
-#define CAN_OFFSET_RECEIVER_ADDR  19
-#define CAN_OFFSET_FUNCTION_MODE  15
-#define CAN_OFFSET_FUNCTION_CODE  5
-#define CAN_OFFSET_MESSAGE_ID     1
+// Taille maximale des données d'une trame (CAN FD, 8 octets en CAN classique)
+#define CAN_MAX_DATA_LENGTH 64
+
+// Débit nominal du bus (bit/s) utilisé pour estimer sa charge, voir CAN::setBitrate
+#define CAN_DEFAULT_BITRATE 1000000
+
+// Temps maximum (en ms) d'attente quand la file d'émission du noyau est pleine
+#define CAN_TX_BUSY_TIMEOUT 100
+
+// Masques et décalages pour extraire les informations d'un message CAN (générés depuis can_id.h)
+#include "can_id_layout.h"
 
 typedef enum {
 	/* Adresses Codées sur 2 bits : 0x0 à 0x3 */
@@ -70,15 +66,15 @@ typedef enum {
 
 
 typedef enum {
-	/* Codes fonctions codés sur 12 bits : 0x0000 à 0x0FFF */
+	/* Codes fonctions codés sur 10 bits : 0x0000 à 0x03FF */
 
     FCT_ACCUSER_RECEPTION = 0x0000,
 
 	FCT_DPL_TRIANGLE      = 0x0021,
 	FCT_DPL_AVANCE        = 0x0029,
 
-	FCT_ERROR             = 0x0FFE,
-	FCT_COMPLETE          = 0x0FFF,
+	FCT_ERROR             = 0x03FE,
+	FCT_COMPLETE          = 0x03FF,
 
 } CanBus_Fnct_Code;
 
@@ -91,12 +87,17 @@ typedef struct {
 
     uint8_t FunctionMode;
 
-    uint8_t Data[8];
+    uint8_t Data[CAN_MAX_DATA_LENGTH];
     uint8_t Length;
+    bool IsFD;              // Trame CAN FD (forcé à l'envoi si Length > 8)
+    bool BitRateSwitch;     // Débit rapide pour les données (CAN FD, en réception)
     uint16_t FunctionCode;
 
     uint8_t MessageID;
     bool IsResp;
+
+    uint64_t Timestamp;         // Réception en ns, horodatage logiciel du noyau (CLOCK_REALTIME), 0 si indisponible
+    uint64_t HardwareTimestamp; // Réception en ns, horloge du contrôleur CAN (non comparable à Timestamp), 0 si indisponible
 } CanBus_FrameFormat;
 
 #endif /* INC_CANBUS_DEFINE_H_ */
\ No newline at end of file
@@ -0,0 +1,547 @@
+/*!
+ * @file bench.cpp
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Banc de mesure de la librairie CAN (deux instances dans le même processus)
+ * @details Usage : CAN_bench [interface|--local] [nombre de trames]
+ *          --local remplace vcan par un socketpair AF_UNIX (mêmes chemins de code, sans filtres noyau)
+ *          Code de retour 1 si send() alloue en CAN_TX_DIRECT avec setFrameLogging(false)
+ */
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "can.h"
+#include "can_coroutine.h"
+
+
+// Allocations faites par le thread courant. malloc et ses variantes (utilisées par operator new) sont interceptés
+// pour tout le programme, puis confiés à l'allocateur de la glibc : new / delete ne sont pas remplacés et restent appariés
+static thread_local uint64_t allocations = 0;
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+
+void *malloc(size_t size) noexcept {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+
+void *calloc(size_t count, size_t size) noexcept {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+
+void *realloc(void *pointer, size_t size) noexcept {
+    allocations++;
+    return __libc_realloc(pointer, size);
+}
+
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+    allocations++;
+    return __libc_memalign(alignment, size);
+}
+}
+
+
+static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+static double cpuSeconds() {
+    rusage usage{};
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+
+// Latences en ns, triées sur place. cpu < 0 => non mesuré pour cette ligne (voir la ligne de total)
+static void report(const std::string &name, std::vector<uint64_t> &latencies, size_t frames, double seconds, double cpu, uint64_t lost = 0) {
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        return latencies.empty() ? 0.0 : latencies[(size_t) (p * (latencies.size() - 1))] / 1000.0;
+    };
+
+    std::cout << std::left << std::setw(22) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << percentile(0.5) << std::setw(10) << percentile(0.99) << std::setw(10) << percentile(0.999)
+              << std::setw(12) << std::setprecision(0) << frames / seconds << std::setw(10) << std::setprecision(2);
+
+    if (cpu < 0)
+        std::cout << "-";
+    else
+        std::cout << cpu * 1e6 / frames;
+
+    std::cout << "   (" << latencies.size() << "/" << frames;
+    if (lost > 0)
+        std::cout << ", " << lost << " abandonnée(s) par l'ordonnanceur";
+    std::cout << ")" << std::endl;
+}
+
+
+// Attend que plus aucune trame n'arrive sur b : les trames en retard d'un scénario ne sont pas comptées dans le suivant
+static void quiesce(CAN &b) {
+    auto total = [&b] {
+        can_stats_t stats = b.stats();
+        uint64_t frames = 0;
+        for (uint64_t count : stats.rxFrames)
+            frames += count;
+        return frames;
+    };
+
+    uint64_t previous;
+    uint64_t current = total();
+    do {
+        previous = current;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        current = total();
+    } while (current != previous);
+}
+
+
+// CPU consommé par tout le processus pendant une pause de duration, en % d'un cœur
+static double idleCpu(std::chrono::milliseconds duration) {
+    double cpu = cpuSeconds();
+    std::this_thread::sleep_for(duration);
+    return 100 * (cpuSeconds() - cpu) / std::chrono::duration<double>(duration).count();
+}
+
+
+// Boucle d'écoute d'avant epoll (poll sans délai, en boucle) comparée à la boucle actuelle : CPU quand le bus
+// est inactif, et latence de réveil pour des trames espacées (le thread d'écoute dort entre deux trames)
+static void listenerLoops(CAN &a, CAN &b) {
+    constexpr size_t wakeups = 200;
+    constexpr auto idle = std::chrono::milliseconds(200);
+    constexpr auto spacing = std::chrono::milliseconds(1);
+
+    auto state = std::make_shared<std::vector<uint64_t>>();
+    state->reserve(wakeups);
+    b.bind(FCT_DPL_TRIANGLE, [state](CAN &, const CanBus_FrameFormat &frame) {
+        uint64_t sent;
+        memcpy(&sent, frame.Data, sizeof(sent));
+        state->push_back(now() - sent);
+    });
+
+    double current = idleCpu(idle);
+    for (size_t i = 0; i < wakeups; i++) {
+        std::array<uint8_t, 8> payload{};
+        uint64_t timestamp = now();
+        memcpy(payload.data(), &timestamp, sizeof(timestamp));
+        a.send(CANBUS_PRIO_STD, CANBUS_BASE_ROULANTE, MODE_DEBUG, FCT_DPL_TRIANGLE, payload, 0, false);
+        std::this_thread::sleep_for(spacing);
+    }
+
+    quiesce(b);
+    b.bind(FCT_DPL_TRIANGLE, nullptr);
+
+    // Ancienne boucle sur un socketpair dédié, mêmes trames écrites directement
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0)
+        return;
+
+    std::vector<uint64_t> spinning;
+    spinning.reserve(wakeups);
+    std::atomic<bool> running{true};
+
+    std::thread spinner([&] {
+        while (running.load()) {
+            pollfd fd{fds[1], POLLIN, 0};
+            if (::poll(&fd, 1, 0) <= 0)
+                continue;
+
+            canfd_frame buffer{};
+            if (::read(fds[1], &buffer, sizeof(buffer)) > 0) {
+                uint64_t sent;
+                memcpy(&sent, buffer.data, sizeof(sent));
+                spinning.push_back(now() - sent);
+            }
+        }
+    });
+
+    double previous = idleCpu(idle);
+    for (size_t i = 0; i < wakeups; i++) {
+        canfd_frame buffer{};
+        uint64_t timestamp = now();
+        memcpy(buffer.data, &timestamp, sizeof(timestamp));
+        ::write(fds[0], &buffer, CAN_MTU);
+        std::this_thread::sleep_for(spacing);
+    }
+
+    running = false;
+    spinner.join();
+    ::close(fds[0]);
+    ::close(fds[1]);
+
+    // Latence de réveil (trames/s : rythme imposé par l'espacement), CPU au repos à part
+    double seconds = wakeups * std::chrono::duration<double>(spacing).count();
+    report("réveil epoll", *state, wakeups, seconds, -1);
+    std::cout << std::left << std::setw(22) << "" << std::fixed << std::setprecision(1) << current << " % d'un cœur au repos" << std::endl;
+    report("réveil poll(0)", spinning, wakeups, seconds, -1);
+    std::cout << std::left << std::setw(22) << "" << std::fixed << std::setprecision(1) << previous << " % d'un cœur au repos" << std::endl;
+}
+
+
+// Réception par lots (setBatchSize) : un écrivain brut remplit le socket plus vite que le récepteur ne le vide,
+// chaque taille de lot a son propre récepteur (la taille se choisit avant startListening)
+static void batchReceive(size_t count, int batch) {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0)
+        return;
+
+    auto rx = std::make_unique<CAN>();
+    rx->init(CANBUS_BASE_ROULANTE, fds[1]);
+    rx->setFrameLogging(false);
+    rx->setBatchSize(batch);
+
+    struct batch_state_t {
+        std::vector<uint64_t> latencies;
+        std::atomic<size_t> received{0};
+    };
+    auto state = std::make_shared<batch_state_t>();
+    state->latencies.reserve(count);
+
+    rx->bind(FCT_DPL_TRIANGLE, [state](CAN &, const CanBus_FrameFormat &frame) {
+        uint64_t sent;
+        memcpy(&sent, frame.Data, sizeof(sent));
+        state->latencies.push_back(now() - sent);
+        state->received.fetch_add(1, std::memory_order_release);
+    });
+    rx->startListening();
+
+    canfd_frame buffer{};
+    buffer.can_id = canIdEncode(CANBUS_PRIO_STD, CANBUS_RASPBERRY, CANBUS_BASE_ROULANTE, MODE_DEBUG, FCT_DPL_TRIANGLE) | CAN_EFF_FLAG;
+    buffer.len = 8;
+
+    can_stats_t before = rx->stats();
+    double cpu = cpuSeconds();
+    uint64_t start = now();
+
+    // Socket plein : on attend qu'il se vide (même comportement qu'un noeud qui inonde le bus)
+    for (size_t i = 0; i < count;) {
+        uint64_t timestamp = now();
+        memcpy(buffer.data, &timestamp, sizeof(timestamp));
+        if (::write(fds[0], &buffer, CAN_MTU) > 0) {
+            i++;
+            continue;
+        }
+
+        pollfd fd{fds[0], POLLOUT, 0};
+        ::poll(&fd, 1, CAN_TX_BUSY_TIMEOUT);
+    }
+
+    while (state->received.load(std::memory_order_acquire) < count && now() - start < 2000000000)
+        std::this_thread::yield();
+
+    double seconds = (now() - start) / 1e9;
+    cpu = cpuSeconds() - cpu;
+    uint64_t reads = rx->stats().rxReads - before.rxReads;
+
+    // Le récepteur est détruit avant la lecture des latences : plus aucun callback en cours
+    rx.reset();
+    ::close(fds[0]);
+
+    report("lot de " + std::to_string(batch), state->latencies, count, seconds, cpu);
+    std::cout << std::left << std::setw(22) << "" << std::fixed << std::setprecision(3)
+              << (double) reads / count << " appel(s) système / trame" << std::endl;
+}
+
+
+// Côté b : renvoie chaque requête comme réponse
+static void echo(CAN &can, const CanBus_FrameFormat &frame) {
+    can.send((CanBus_Priority) frame.Priority, (CanBus_Address) frame.SenderAddress, (CanBus_Fnct_Mode) frame.FunctionMode,
+             (CanBus_Fnct_Code) frame.FunctionCode, std::span<const uint8_t>(frame.Data, frame.Length), frame.MessageID, true);
+}
+
+
+// Requête / réponse synchrone : latence aller-retour
+static void pingPong(CAN &a, CAN &b, size_t count) {
+    b.bind(FCT_DPL_AVANCE, echo);
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(count);
+    std::vector<uint8_t> payload(8, 0x55);
+
+    double cpu = cpuSeconds();
+    uint64_t start = now();
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t sent = now();
+        can_result_t result = a.send(CANBUS_PRIO_STD, CANBUS_BASE_ROULANTE, MODE_DEBUG, FCT_DPL_AVANCE, payload, std::chrono::milliseconds(100));
+        if (result.status == CAN_OK)
+            latencies.push_back(now() - sent);
+    }
+
+    // Deux trames par requête
+    report("ping-pong (RTT)", latencies, 2 * count, (now() - start) / 1e9, cpuSeconds() - cpu);
+}
+
+
+// Requêtes successives dans une coroutine, reprise par l'exécuteur à chaque réponse (fonction libre :
+// une lambda coroutine temporaire serait détruite à la première suspension)
+static CanTask requestLoop(CAN &a, CanExecutor &executor, const std::vector<uint8_t> &payload, size_t count, std::vector<uint64_t> &latencies) {
+    for (size_t i = 0; i < count; i++) {
+        uint64_t sent = now();
+        can_result_t result = co_await a.request(CANBUS_PRIO_STD, CANBUS_BASE_ROULANTE, MODE_DEBUG, FCT_DPL_AVANCE, payload,
+                                                 std::chrono::steady_clock::now() + std::chrono::milliseconds(100), executor);
+        if (result.status == CAN_OK)
+            latencies.push_back(now() - sent);
+    }
+
+    executor.stop();
+}
+
+
+// Même aller-retour que pingPong, complété par le thread d'écoute : attente sur std::future, ou reprise
+// d'une coroutine par CanExecutor dans ce thread (post() + run()). L'écart est le coût du mécanisme de reprise
+static void asyncPingPong(CAN &a, CAN &b, size_t count) {
+    b.bind(FCT_DPL_AVANCE, echo);
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(count);
+    std::vector<uint8_t> payload(8, 0x55);
+
+    double cpu = cpuSeconds();
+    uint64_t start = now();
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t sent = now();
+        auto future = a.sendAsync(CANBUS_PRIO_STD, CANBUS_BASE_ROULANTE, MODE_DEBUG, FCT_DPL_AVANCE, payload, std::chrono::milliseconds(100));
+        if (future.get().status == CAN_OK)
+            latencies.push_back(now() - sent);
+    }
+
+    report("std::future (RTT)", latencies, 2 * count, (now() - start) / 1e9, cpuSeconds() - cpu);
+
+    CanExecutor executor;
+    latencies.clear();
+
+    cpu = cpuSeconds();
+    start = now();
+
+    // La coroutine s'exécute jusqu'au premier co_await, puis run() la reprend jusqu'à executor.stop()
+    requestLoop(a, executor, payload, count, latencies);
+    executor.run();
+
+    report("coroutine (RTT)", latencies, 2 * count, (now() - start) / 1e9, cpuSeconds() - cpu);
+}
+
+
+// Envoi continu sans réponse : latence aller simple (horodatage dans les données) et débit
+static void flood(CAN &a, CAN &b, size_t count, bool mixed) {
+    // Partagé avec le callback : bind(code, nullptr) n'attend pas la fin d'un appel en cours dans le thread d'écoute
+    struct flood_state_t {
+        std::vector<uint64_t> latencies[CAN_PRIORITY_COUNT];
+        std::atomic<size_t> received{0};
+    };
+    auto state = std::make_shared<flood_state_t>();
+    for (auto &priority : state->latencies)
+        priority.reserve(count);
+
+    // Un seul thread d'écoute côté b : pas de concurrence sur les vecteurs
+    b.bind(FCT_DPL_TRIANGLE, [state](CAN &, const CanBus_FrameFormat &frame) {
+        uint64_t sent;
+        memcpy(&sent, frame.Data, sizeof(sent));
+        state->latencies[frame.Priority].push_back(now() - sent);
+        state->received.fetch_add(1, std::memory_order_release);
+    });
+
+    // L'ordonnanceur attend que la file du noyau se libère (EAGAIN / ENOBUFS) au lieu de perdre la trame.
+    // Mode mixte : count / 10 trames CANBUS_PRIO_HIGH toutes les 100 µs (sous la capacité du lien) au milieu d'un
+    // flot CANBUS_PRIO_INFO continu. Si la file du noyau se remplissait d'INFO, les HIGH attendraient derrière elles.
+    // La file INFO est ici en CAN_OVERFLOW_DROP_NEWEST : chaque trame INFO acceptée attend son tour (sinon seules
+    // les plus récentes passent et leur latence ne dit rien de l'ordonnancement)
+    constexpr uint64_t highPeriod = 100000;
+    if (mixed)
+        a.setTxQueue(CANBUS_PRIO_INFO, {64, CAN_OVERFLOW_DROP_NEWEST, std::chrono::milliseconds(100)});
+
+    a.setTxScheduler(CAN_TX_STRICT);
+    can_stats_t before = a.stats();
+
+    double cpu = cpuSeconds();
+    uint64_t start = now();
+    uint64_t nextHigh = start;
+    size_t sent[CAN_PRIORITY_COUNT]{};
+
+    while (mixed ? sent[CANBUS_PRIO_HIGH] < count / 10 : sent[CANBUS_PRIO_STD] < count) {
+        CanBus_Priority priority = !mixed ? CANBUS_PRIO_STD : now() >= nextHigh ? CANBUS_PRIO_HIGH : CANBUS_PRIO_INFO;
+        if (priority == CANBUS_PRIO_HIGH)
+            nextHigh += highPeriod;
+
+        std::array<uint8_t, 8> payload{};
+
+        // File pleine (CAN_OVERFLOW_DROP_NEWEST) : on réessaie en laissant la main aux threads d'émission
+        // et d'écoute, comme un émetteur qui respecte la contre-pression
+        while (true) {
+            uint64_t timestamp = now();
+            memcpy(payload.data(), &timestamp, sizeof(timestamp));
+            if (a.send(priority, CANBUS_BASE_ROULANTE, MODE_DEBUG, FCT_DPL_TRIANGLE, payload, 0, false).status == CAN_OK)
+                break;
+
+            std::this_thread::yield();
+        }
+
+        sent[priority]++;
+    }
+
+    size_t total = 0;
+    for (size_t frames : sent)
+        total += frames;
+
+    // On attend les dernières trames (au plus 2 s), les trames abandonnées par l'ordonnanceur n'arriveront pas
+    auto lost = [&a, &before] {
+        can_stats_t stats = a.stats();
+        return (stats.txDropped - before.txDropped) + (stats.txExpired - before.txExpired);
+    };
+
+    while (state->received.load(std::memory_order_acquire) + lost() < total && now() - start < 2000000000)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    double seconds = (now() - start) / 1e9;
+    cpu = cpuSeconds() - cpu;
+
+    // Les trames encore en file sont abandonnées et comptées à l'arrêt de l'ordonnanceur (txDropped)
+    a.setTxScheduler(CAN_TX_DIRECT);
+    a.setTxQueue(CANBUS_PRIO_INFO, CAN_TX_QUEUES_DEFAULT[CANBUS_PRIO_INFO]);
+    uint64_t dropped = lost();
+
+    quiesce(b);
+    b.bind(FCT_DPL_TRIANGLE, nullptr);
+
+    auto &latencies = state->latencies;
+    if (!mixed) {
+        report("flood (aller simple)", latencies[CANBUS_PRIO_STD], count, seconds, cpu, dropped);
+        return;
+    }
+
+    // Le CPU n'est mesuré que pour l'ensemble du scénario : pas de répartition par priorité
+    std::vector<uint64_t> all;
+    all.insert(all.end(), latencies[CANBUS_PRIO_HIGH].begin(), latencies[CANBUS_PRIO_HIGH].end());
+    all.insert(all.end(), latencies[CANBUS_PRIO_INFO].begin(), latencies[CANBUS_PRIO_INFO].end());
+
+    report("mixte HIGH", latencies[CANBUS_PRIO_HIGH], sent[CANBUS_PRIO_HIGH], seconds, -1);
+    report("mixte INFO", latencies[CANBUS_PRIO_INFO], sent[CANBUS_PRIO_INFO], seconds, -1);
+    report("mixte (total)", all, total, seconds, cpu, dropped);
+}
+
+
+// Coût d'un appel à send() (span, sans réponse attendue) et allocations faites par cet appel.
+// Envois par salves plus petites que les files (noyau et ordonnanceur) : aucune trame refusée, donc aucun log
+static uint64_t sendPath(CAN &a, CAN &b, size_t count, can_tx_mode_t mode) {
+    constexpr size_t burst = 32;
+
+    auto received = std::make_shared<std::atomic<size_t>>(0);
+    b.bind(FCT_DPL_TRIANGLE, [received](CAN &, const CanBus_FrameFormat &) {
+        received->fetch_add(1, std::memory_order_release);
+    });
+
+    a.setTxScheduler(mode);
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(count);
+    std::array<uint8_t, 8> payload{};
+    uint64_t allocated = 0;
+    uint64_t elapsed = 0;
+
+    double cpu = cpuSeconds();
+    for (size_t sent = 0; sent < count;) {
+        for (size_t i = 0; i < burst && sent < count; i++, sent++) {
+            memcpy(payload.data(), &sent, sizeof(sent));
+
+            uint64_t before = allocations;
+            uint64_t start = now();
+            can_status_t status = a.send(CANBUS_PRIO_STD, CANBUS_BASE_ROULANTE, MODE_DEBUG, FCT_DPL_TRIANGLE, payload, 0, false).status;
+            uint64_t duration = now() - start;
+            allocated += allocations - before;
+
+            if (status == CAN_OK) {
+                latencies.push_back(duration);
+                elapsed += duration;
+            }
+        }
+
+        // La salve est arrivée (au plus 100 ms) : les files sont vides pour la suivante
+        uint64_t start = now();
+        while (received->load(std::memory_order_acquire) < sent && now() - start < 100000000)
+            std::this_thread::yield();
+    }
+    cpu = cpuSeconds() - cpu;
+
+    a.setTxScheduler(CAN_TX_DIRECT);
+    quiesce(b);
+    b.bind(FCT_DPL_TRIANGLE, nullptr);
+
+    // Débit : appels à send() seuls, sans l'attente des salves
+    report(mode == CAN_TX_DIRECT ? "send() direct" : "send() ordonnanceur", latencies, count, elapsed ? elapsed / 1e9 : 1, cpu);
+    std::cout << std::left << std::setw(22) << "" << allocated << " allocation(s) dans send() pour " << count << " envois" << std::endl;
+    return allocated;
+}
+
+
+int main(int argc, char **argv) {
+    std::string interface = argc > 1 ? argv[1] : "vcan0";
+    size_t count = argc > 2 ? std::stoul(argv[2]) : 10000;
+
+    CAN a, b;
+    int status;
+
+    if (interface == "--local") {
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0) {
+            std::cerr << "Impossible de créer le socketpair" << std::endl;
+            return 1;
+        }
+        status = a.init(CANBUS_RASPBERRY, fds[0]) | b.init(CANBUS_BASE_ROULANTE, fds[1]);
+    } else {
+        status = a.init(CANBUS_RASPBERRY, interface) | b.init(CANBUS_BASE_ROULANTE, interface);
+    }
+
+    if (status < 0) {
+        std::cerr << "Interface " << interface << " indisponible (essayer --local)" << std::endl;
+        return 1;
+    }
+
+    a.setFrameLogging(false);
+    b.setFrameLogging(false);
+    a.startListening();
+    b.startListening();
+
+    std::cout << "Interface : " << interface << ", " << count << " trames par scénario" << std::endl;
+    std::cout << std::left << std::setw(22) << "scénario" << std::right << std::setw(10) << "p50 µs" << std::setw(10) << "p99 µs"
+              << std::setw(10) << "p99.9 µs" << std::setw(12) << "trames/s" << std::setw(10) << "CPU µs" << std::endl;
+
+    listenerLoops(a, b);
+    pingPong(a, b, count);
+    asyncPingPong(a, b, count);
+    flood(a, b, count, false);
+    flood(a, b, count, true);
+
+    // Chemin garanti sans allocation (CAN_TX_DIRECT, setFrameLogging(false)) : échec du banc sinon
+    uint64_t allocated = sendPath(a, b, count, CAN_TX_DIRECT);
+    sendPath(a, b, count, CAN_TX_STRICT);
+
+    batchReceive(count, 1);
+    batchReceive(count, 8);
+    batchReceive(count, CAN_MAX_BATCH);
+    return allocated > 0;
+}
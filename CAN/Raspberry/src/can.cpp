@@ -8,16 +8,25 @@
  */
 
 #include <fcntl.h>
+#include <cstdio>
 #include <cstring>
 #include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/can/error.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
 #include <net/if.h>
 #include <sys/poll.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
 #include <bits/ioctls.h>
 #include <unistd.h>
 
 #include "../include/can.h"
+#include "../include/can_event_loop.h"
+#include "../include/can_recorder.h"
 
 
 inline void printError(Logger &logger, Log level = CRITICAL, const std::string_view &message = "") {
@@ -26,20 +35,21 @@ inline void printError(Logger &logger, Log level = CRITICAL, const std::string_v
 }
 
 
-int CAN::init(CanBus_Address myAddress) {
+int CAN::init(CanBus_Address myAddress, const std::string &interface) {
     // Création du socket en mode non-bloquant
     address = myAddress;
+    interfaceName = interface;
     socket = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
     fcntl(socket, F_SETFL, O_NONBLOCK);
 
     // Vérification de la création du socket
     ifreq ifr{};
     sockaddr_can addr{};
-    strcpy(ifr.ifr_name, CAN_INTERFACE);
+    strncpy(ifr.ifr_name, interfaceName.c_str(), IFNAMSIZ - 1);
 
     if (::ioctl(socket, SIOCGIFFLAGS, &ifr) < 0) {
         printError(logger, CRITICAL, "Impossible de récupérer les flags de l'interface");
-        logger(INFO) << CAN_INTERFACE << std::endl;
+        logger(INFO) << interfaceName << std::endl;
         return -1;
     }
 
@@ -55,7 +65,7 @@ int CAN::init(CanBus_Address myAddress) {
         return -1;
     }
 
-    logger(INFO) << "Adresse Hardware de l'interface " << CAN_INTERFACE << " : ";
+    logger(INFO) << "Adresse Hardware de l'interface " << interfaceName << " : ";
     for (int i = 0; i < 6; i++)
         logger << std::hex << std::showbase << (int) ifr.ifr_hwaddr.sa_data[i] << " ";
     logger << std::dec << std::endl;
@@ -75,11 +85,128 @@ int CAN::init(CanBus_Address myAddress) {
         return -1;
     }
 
-    logger(INFO) << "Bus CAN initialisé" << std::endl;
+    return setupEvents();
+}
+
+
+int CAN::init(CanBus_Address myAddress, int fd) {
+    // Socket déjà ouvert qui transporte des canfd_frame, sans options CAN (socketpair AF_UNIX/SOCK_SEQPACKET
+    // pour les tests sans vcan). Le filtrage par adresse se fait alors uniquement dans readBuffer
+    address = myAddress;
+    interfaceName = "fd" + std::to_string(fd);
+    socket = fd;
+    canSocket = false;
+    fcntl(socket, F_SETFL, O_NONBLOCK);
+
+    return setupEvents();
+}
+
+
+int CAN::setupEvents() {
+    // Le thread d'écoute dort dans epoll_wait jusqu'à ce que le socket soit lisible
+    // ou que eventFd soit écrit (par le destructeur pour arrêter l'écoute)
+    epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+    eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (epollFd < 0 || eventFd < 0) {
+        printError(logger, CRITICAL, "Impossible de créer l'instance epoll");
+        return -1;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+
+    event.data.fd = socket;
+    if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, socket, &event) < 0) {
+        printError(logger, CRITICAL, "Impossible d'ajouter le socket à epoll");
+        return -1;
+    }
+
+    event.data.fd = eventFd;
+    if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &event) < 0) {
+        printError(logger, CRITICAL, "Impossible d'ajouter l'eventfd à epoll");
+        return -1;
+    }
+
+    if (updateFilters() < 0)
+        return -1;
+
+    // Sans trames d'erreur, on perd seulement les statistiques de santé du bus
+    if (canSocket)
+        setErrorMonitoring(true);
+
+    logger(INFO) << "Bus CAN initialisé sur " << interfaceName << std::endl;
+    return 0;
+}
+
+
+int CAN::updateFilters() {
+    // Le socket n'est pas encore créé, les filtres seront installés par init()
+    if (socket < 0 || !canSocket)
+        return 0;
+
+    // Seules les trames étendues (29 bits) de données nous concernent
+    const canid_t baseMask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_FIELD_RECEIVER_ADDR.mask();
+    const canid_t targets[] = {
+        CAN_FIELD_RECEIVER_ADDR.encode(address),
+        CAN_FIELD_RECEIVER_ADDR.encode(CANBUS_BROADCAST)
+    };
+
+    std::vector<can_filter> filters;
+
+    // Sans filtrage par code fonction (ou s'il y en a trop pour le noyau),
+    // on accepte toutes les trames adressées à nous ou en broadcast
+    if (!filterFunctions || boundCount > CAN_RAW_FILTER_MAX / 2 - 2) {
+        for (canid_t target : targets)
+            filters.push_back({target | CAN_EFF_FLAG, baseMask});
+    } else {
+        // Les réponses sont toujours acceptées, peu importe le code fonction
+        for (canid_t target : targets)
+            filters.push_back({target | CAN_FIELD_IS_RESPONSE.mask() | CAN_EFF_FLAG, baseMask | CAN_FIELD_IS_RESPONSE.mask()});
+
+        // Puis une paire de filtres par code fonction lié
+        for (int code = 0; code < CAN_FUNCTION_CODE_COUNT; code++) {
+            if (!callbacks[code])
+                continue;
+
+            for (canid_t target : targets)
+                filters.push_back({
+                    target | CAN_FIELD_FUNCTION_CODE.encode(code) | CAN_EFF_FLAG,
+                    baseMask | CAN_FIELD_FUNCTION_CODE.mask()
+                });
+        }
+    }
+
+    // Passerelle : les codes fonction relayés sont acceptés quel que soit le destinataire
+    for (int code = 0; forwardCount > 0 && code < CAN_FUNCTION_CODE_COUNT; code++)
+        if (forwards[code] != nullptr)
+            filters.push_back({
+                CAN_FIELD_FUNCTION_CODE.encode(code) | CAN_EFF_FLAG,
+                CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_FIELD_FUNCTION_CODE.mask()
+            });
+
+    // Écho de nos propres trames (émetteur = nous), reconnu ensuite grâce à MSG_CONFIRM
+    if (receiveOwn)
+        filters.push_back({
+            CAN_FIELD_EMIT_ADDR.encode(address) | CAN_EFF_FLAG,
+            CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_FIELD_EMIT_ADDR.mask()
+        });
+
+    if (::setsockopt(socket, SOL_CAN_RAW, CAN_RAW_FILTER, filters.data(), filters.size() * sizeof(can_filter)) < 0) {
+        printError(logger, ERROR, "Impossible d'installer les filtres CAN");
+        return -1;
+    }
+
     return 0;
 }
 
 
+int CAN::setFunctionFilter(bool enabled) {
+    filterFunctions = enabled;
+    return updateFilters();
+}
+
+
 void CAN::print(const CanBus_FrameFormat &frame) {
     logger(INFO) << "Message reçu :\n" << std::hex << std::showbase
     	   << "  - Priorité : " << (int) frame.Priority << "\n"
@@ -88,6 +215,7 @@ void CAN::print(const CanBus_FrameFormat &frame) {
            << "  - Mode Fonction : " << (int) frame.FunctionMode << "\n"
            << "  - Code fonction : " << (int) frame.FunctionCode << "\n"
            << "  - ID message : " << (int) frame.MessageID << "\n"
+           << "  - Format : " << (frame.IsFD ? (frame.BitRateSwitch ? "CAN FD (BRS)" : "CAN FD") : "classique") << "\n"
            << "  - Données : ";
 
     for (int i = 0; i < frame.Length; i++)
@@ -102,163 +230,1532 @@ int CAN::startListening() {
         return -1;
     }
 
+    // Les tampons sont alloués une seule fois, avant le démarrage du thread
+    rxRing = std::make_unique<can_rx_ring_t>();
+
+    for (int i = 0; i < CAN_MAX_BATCH; i++) {
+        rxRing->iovecs[i] = {&rxRing->buffers[i], sizeof(canfd_frame)};
+        rxRing->headers[i].msg_hdr = {};
+        rxRing->headers[i].msg_hdr.msg_iov = &rxRing->iovecs[i];
+        rxRing->headers[i].msg_hdr.msg_iovlen = 1;
+        rxRing->headers[i].msg_hdr.msg_control = rxRing->controls[i];
+    }
+
     isListening = true;
-    listenerThread = std::make_unique<std::thread>(&CAN::listen, this);
 
-    logger(INFO) << "Le bus CAN est sous écoute" << std::endl;
+    // Boucle partagée : c'est son thread qui videra notre socket
+    if (eventLoop != nullptr) {
+        if (eventLoop->add(*this) < 0) {
+            isListening = false;
+            eventLoop = nullptr;
+            return -1;
+        }
+    } else {
+        listenerThread = std::make_unique<std::thread>(&CAN::listen, this);
+    }
+
+    logger(INFO) << "Le bus CAN " << interfaceName << " est sous écoute" << std::endl;
     return 0;
 }
 
 
+int CAN::startListening(CanEventLoop &loop) {
+    if (isListening) {
+        logger(WARNING) << "Le socket est déjà en écoute" << std::endl;
+        return -1;
+    }
+
+    eventLoop = &loop;
+    return startListening();
+}
+
+
+void CAN::wake() {
+    // Réveille le thread qui attend nos échéances (le nôtre ou celui de la boucle partagée)
+    if (eventLoop != nullptr)
+        eventLoop->wake();
+    else
+        ::eventfd_write(eventFd, 1);
+}
+
+
 void CAN::listen() {
     // "socket" est un entier qui indique comment accéder à une ressource et à quoi elle correspond (file descriptor)
-    // On utilise un pollfd pour vérifier de manière non-bloquante si des données sont disponibles
-    pollfd fd{ socket, POLLIN, 0 };
-
-    int status;
-    can_frame buffer{};
-    CanBus_FrameFormat frame{};
+    // On bloque dans epoll_wait : aucun CPU n'est consommé tant que le bus est inactif
+    epoll_event events[2];
 
     while (isListening.load()) {
-        // On regarde si des données sont disponibles, 0 => pas de timeout
-        status = ::poll(&fd, 1, 0);
+        // On est réveillé par le socket, par eventFd ou à l'échéance de la prochaine requête
+        int count = ::epoll_wait(epollFd, events, 2, nextTimeout());
+        expireRequests();
 
-        // "status == 0" => timeout, "status < 0" => erreur
-        if (status == 0)
-            continue;
-        else if (status < 0) {
-            printError(logger, ERROR, "Erreur lors de l'écoute du bus CAN");
+        if (count < 0) {
+            if (errno != EINTR)
+                printError(logger, ERROR, "Erreur lors de l'écoute du bus CAN");
             continue;
         }
-	
-	//Affichage de la trame avant traitement
-	logger(INFO) << "ID et Data de la trame : " << (buffer.can_id ^ CAN_EFF_FLAG) << buffer.data << std::endl;
-	
-        // Traitement du buffer
-        if (readBuffer(frame, buffer) < 0)
-            continue;
 
-        // On affiche le message et on le traite
-        print(frame);
+        for (int i = 0; i < count; i++) {
+            // Réveil par le destructeur (isListening est vérifié par la boucle principale)
+            // ou par une nouvelle requête (l'échéance est recalculée par nextTimeout)
+            if (events[i].data.fd == eventFd) {
+                eventfd_t value;
+                ::eventfd_read(eventFd, &value);
+                continue;
+            }
 
-        // Si c'est une réponse, on bloque l'accès à responses dans d'autres threads
-        if (frame.IsResp) {
-            std::lock_guard<std::mutex> lock(mutex);
-            responses[frame.MessageID] = frame;
-            continue;
+            drain();
         }
+    }
+}
 
-        auto callback = callbacks.find(frame.FunctionCode);
 
-        if (callback != callbacks.end()) {
-            callback->second(*this, frame);
-            continue;
+void CAN::drain() {
+    // Le socket est non-bloquant, on lit les trames en attente (au plus CAN_MAX_DRAIN par réveil)
+    int received;
+    int drained = 0;
+    while (drained < CAN_MAX_DRAIN && isListening.load(std::memory_order_relaxed) && (received = receive()) > 0) {
+        drained += received;
+
+        // On décode tout le lot avant de le traiter
+        int decoded = 0;
+        for (int j = 0; j < received; j++) {
+            const msghdr &header = rxRing->headers[j].msg_hdr;
+            canfd_frame &buffer = rxRing->buffers[j];
+
+            // Horodatages lus une seule fois, partagés par l'enregistreur, l'écho et la trame décodée
+            uint64_t hardware;
+            uint64_t timestamp = readTimestamp(header, &hardware);
+
+            // Enregistrement de toutes les trames lues (erreurs et échos compris), sans appel système
+            if (recorder != nullptr)
+                recorder->append(buffer, rxRing->headers[j].msg_len, timestamp);
+
+            // MSG_CONFIRM => écho d'une de nos trames (CAN_RAW_RECV_OWN_MSGS)
+            if (header.msg_flags & MSG_CONFIRM) {
+                confirmRequest(buffer, timestamp);
+                continue;
+            }
+
+            // Trame d'erreur générée par le contrôleur (CAN_RAW_ERR_FILTER), jamais relayée
+            if (buffer.can_id & CAN_ERR_FLAG) {
+                handleError(buffer);
+                continue;
+            }
+
+            // Passerelle : la trame est relayée telle quelle, avant tout décodage
+            CAN *target = forwards[CAN_FIELD_FUNCTION_CODE.decode(buffer.can_id)];
+            if (target != nullptr) {
+                if (rxRing->headers[j].msg_len == CANFD_MTU)
+                    buffer.flags |= CANFD_FDF;
+                target->transmit(buffer);
+            }
+
+            if (readBuffer(rxRing->frames[decoded], buffer, rxRing->headers[j].msg_len) == 0) {
+                CanBus_FrameFormat &frame = rxRing->frames[decoded++];
+                frame.Timestamp = timestamp;
+                frame.HardwareTimestamp = hardware;
+            }
         }
 
-        logger(WARNING) << "Aucun callback pour le code fonction " << (int) frame.FunctionCode << std::endl;
+        for (int j = 0; j < decoded; j++)
+            processFrame(rxRing->frames[j]);
+
+        // Lot incomplet => le socket est vide, inutile de refaire un appel système
+        if (received < batchSize)
+            break;
     }
 }
 
 
-int CAN::readBuffer(CanBus_FrameFormat &frame, can_frame &buffer) {
-    // Lecture du buffer
-    if (::read(socket, &buffer, sizeof(can_frame)) < 0) {
+int CAN::receive() {
+    int received;
+
+    // Le noyau réduit msg_controllen à la taille réellement utilisée, on la remet à chaque appel
+    for (int i = 0; i < batchSize; i++)
+        rxRing->headers[i].msg_hdr.msg_controllen = CAN_CONTROL_SIZE;
+
+    counters.rxReads.fetch_add(1, std::memory_order_relaxed);
+
+    // recvmsg plutôt que read pour récupérer les horodatages et les flags (MSG_CONFIRM)
+    // msg_len (taille lue) distingue les trames classiques (CAN_MTU) des trames FD (CANFD_MTU)
+    if (batchSize == 1) {
+        ssize_t size = ::recvmsg(socket, &rxRing->headers[0].msg_hdr, MSG_DONTWAIT);
+        rxRing->headers[0].msg_len = size < 0 ? 0 : size;
+        received = size <= 0 ? (int) size : 1;
+    } else {
+        received = ::recvmmsg(socket, rxRing->headers, batchSize, MSG_DONTWAIT, nullptr);
+        if (received > 0 && rxRing->headers[0].msg_len == 0)
+            received = 0;
+    }
+
+    // 0 => fin de flux (l'autre extrémité d'un socket adopté a été fermée, jamais sur un socket CAN) :
+    // on retire le socket d'epoll pour ne pas être réveillé en boucle
+    if (received == 0) {
+        logger(WARNING) << "Fin de flux sur " << interfaceName << ", arrêt de la réception" << std::endl;
+        ::epoll_ctl(eventLoop != nullptr ? eventLoop->epollFd : epollFd, EPOLL_CTL_DEL, socket, nullptr);
+    }
+
+    if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
         printError(logger, ERROR, "Impossible de lire le buffer");
+
+    return received;
+}
+
+
+uint64_t CAN::readTimestamp(const msghdr &header, uint64_t *hardware) {
+    // Les deux horloges ne sont pas comparables : l'horodatage matériel (horloge du contrôleur)
+    // n'est renvoyé que dans *hardware, jamais à la place de l'horodatage logiciel (CLOCK_REALTIME)
+    uint64_t software = 0;
+    if (hardware != nullptr)
+        *hardware = 0;
+
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr; cmsg = CMSG_NXTHDR((msghdr *) &header, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+
+        timespec ts[3]{};
+
+        // SO_TIMESTAMPING : ts[2] = horodatage matériel brut, si le driver le fournit
+        if (cmsg->cmsg_type == SO_TIMESTAMPING && hardware != nullptr) {
+            memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+            *hardware = (uint64_t) ts[2].tv_sec * 1000000000 + ts[2].tv_nsec;
+        }
+
+        // SO_TIMESTAMPNS : horodatage logiciel, à l'arrivée de la trame dans le noyau
+        if (cmsg->cmsg_type == SO_TIMESTAMPNS) {
+            memcpy(ts, CMSG_DATA(cmsg), sizeof(timespec));
+            software = (uint64_t) ts[0].tv_sec * 1000000000 + ts[0].tv_nsec;
+        }
+    }
+
+    return software;
+}
+
+
+int CAN::setTimestamps(bool enabled) {
+    int value = enabled;
+    if (::setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof(value)) < 0) {
+        printError(logger, ERROR, "Impossible d'activer les horodatages");
         return -1;
     }
 
-    // dlc = Data Length code (taille des données)
-    if (buffer.can_dlc > 8) {
-        logger(WARNING) << "Taille du message trop grande : " << buffer.can_dlc << std::endl;
+    // Horodatage matériel en plus (CanBus_FrameFormat::HardwareTimestamp) : le driver doit d'abord l'activer
+    // sur l'interface (SIOCSHWTSTAMP, CAP_NET_ADMIN requis). Sans lui, RX_HARDWARE seul ne fournit rien
+    if (enabled && canSocket && !hardwareTimestamps) {
+        hwtstamp_config config{};
+        config.tx_type = HWTSTAMP_TX_OFF;
+        config.rx_filter = HWTSTAMP_FILTER_ALL;
+
+        ifreq ifr{};
+        strncpy(ifr.ifr_name, interfaceName.c_str(), IFNAMSIZ - 1);
+        ifr.ifr_data = (char *) &config;
+
+        hardwareTimestamps = ::ioctl(socket, SIOCSHWTSTAMP, &ifr) == 0;
+        if (!hardwareTimestamps)
+            printError(logger, INFO, "Horodatage matériel indisponible, horodatage logiciel seulement");
+    }
+
+    int flags = enabled && hardwareTimestamps ? SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE : 0;
+    ::setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+
+    return 0;
+}
+
+
+int CAN::setReceiveOwnMessages(bool enabled) {
+    int value = enabled;
+    if (::setsockopt(socket, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &value, sizeof(value)) < 0) {
+        printError(logger, ERROR, "Impossible d'activer CAN_RAW_RECV_OWN_MSGS");
         return -1;
     }
 
-    // On filtre pour n'avoir que la partie qui correspond à l'adresse du récepteur
-    // et on la décale pour avoir la vraie valeur
-    frame.ReceiverAddress = (buffer.can_id & CAN_MASK_RECEIVER_ADDR) >> CAN_OFFSET_RECEIVER_ADDR;
+    // Nos trames sont adressées aux autres noeuds, il faut aussi les laisser passer dans les filtres
+    receiveOwn = enabled;
+    return updateFilters();
+}
+
+
+int CAN::setFdFrames(bool enabled, bool brs) {
+    // Sur une interface classique (MTU de 16 octets), l'écriture d'une trame FD échouerait
+    ifreq ifr{};
+    strncpy(ifr.ifr_name, interfaceName.c_str(), IFNAMSIZ - 1);
 
-    if (address != frame.ReceiverAddress && frame.ReceiverAddress != CANBUS_BROADCAST) {
+    if (enabled && (::ioctl(socket, SIOCGIFMTU, &ifr) < 0 || ifr.ifr_mtu != CANFD_MTU)) {
+        logger(ERROR) << "L'interface " << interfaceName << " ne supporte pas le CAN FD" << std::endl;
         return -1;
     }
 
-    // Même démarche pour les autres champs
-    frame.Priority        = (buffer.can_id & CAN_MASK_PRIORITY) >> CAN_OFFSET_PRIORITY;
-    frame.SenderAddress   = (buffer.can_id & CAN_MASK_EMIT_ADDR) >> CAN_OFFSET_EMIT_ADDR;
-    frame.FunctionMode    = (buffer.can_id & CAN_MASK_FUNCTION_MODE) >> CAN_OFFSET_FUNCTION_MODE;
-    frame.FunctionCode    = (buffer.can_id & CAN_MASK_FUNCTION_CODE) >> CAN_OFFSET_FUNCTION_CODE;
-    frame.MessageID       = (buffer.can_id & CAN_MASK_MESSAGE_ID) >> CAN_OFFSET_MESSAGE_ID;
-    frame.IsResp      = buffer.can_id & CAN_MASK_IS_RESPONSE;
+    int value = enabled;
+    if (::setsockopt(socket, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &value, sizeof(value)) < 0) {
+        printError(logger, ERROR, "Impossible d'activer CAN_RAW_FD_FRAMES");
+        return -1;
+    }
 
-    // Copie des données
-    frame.Length = buffer.can_dlc;
-    memcpy(frame.Data, buffer.data, buffer.can_dlc);
+    fdFrames = enabled;
+    bitRateSwitch = brs;
+    return 0;
+}
+
+
+int CAN::setErrorMonitoring(bool enabled) {
+    // CAN_ERR_BUSERROR est exclu : certains contrôleurs en génèrent une par trame ratée
+    can_err_mask_t mask = enabled ? CAN_ERR_MASK & ~CAN_ERR_BUSERROR : 0;
+
+    if (::setsockopt(socket, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &mask, sizeof(mask)) < 0) {
+        printError(logger, WARNING, "Impossible de s'abonner aux trames d'erreur");
+        return -1;
+    }
 
     return 0;
 }
 
 
-can_result_t CAN::send(
-        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &Data,
-        uint8_t MessageID, bool IsResp, int timeout // timeout si on attend une réponse
-) {
-    if (Data.size() > 8) {
-        logger(WARNING) << "Taille du message trop grande : " << Data.size() << std::endl;
-        return {CAN_ERROR};
+void CAN::handleError(const canfd_frame &buffer) {
+    // Format des trames d'erreur : voir linux/can/error.h
+    constexpr auto relaxed = std::memory_order_relaxed;
+    can_bus_state_t previous = counters.state.load(relaxed);
+    can_bus_state_t state = previous;
+
+    counters.errorFrames.fetch_add(1, relaxed);
+
+    if (buffer.can_id & CAN_ERR_LOSTARB)
+        counters.arbitrationLost.fetch_add(1, relaxed);
+    if (buffer.can_id & CAN_ERR_PROT)
+        counters.protocolErrors.fetch_add(1, relaxed);
+    if (buffer.can_id & CAN_ERR_ACK)
+        counters.ackErrors.fetch_add(1, relaxed);
+
+    if (buffer.can_id & CAN_ERR_CRTL) {
+        uint8_t status = buffer.data[1];
+
+        if (status & (CAN_ERR_CRTL_RX_OVERFLOW | CAN_ERR_CRTL_TX_OVERFLOW))
+            counters.overflows.fetch_add(1, relaxed);
+
+        if (status & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE))
+            state = CAN_STATE_PASSIVE;
+        else if (status & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING))
+            state = CAN_STATE_WARNING;
+        else if (status & CAN_ERR_CRTL_ACTIVE)
+            state = CAN_STATE_ACTIVE;
     }
 
-    can_frame buffer{};
-    buffer.len = Data.size();
-    memcpy(buffer.data, Data.data(), Data.size());
+    if (buffer.can_id & CAN_ERR_BUSOFF) {
+        counters.busOff.fetch_add(1, relaxed);
+        state = CAN_STATE_BUS_OFF;
+    }
 
-    buffer.can_id = Priority     << CAN_OFFSET_PRIORITY      |
-                    address      << CAN_OFFSET_EMIT_ADDR     |
-                    dest         << CAN_OFFSET_RECEIVER_ADDR |
-                    FunctionMode << CAN_OFFSET_FUNCTION_MODE |
-                    FunctionCode << CAN_OFFSET_FUNCTION_CODE |
-                    MessageID    << CAN_OFFSET_MESSAGE_ID    |
-                    IsResp   |  CAN_EFF_FLAG;
+    if (buffer.can_id & CAN_ERR_RESTARTED)
+        state = CAN_STATE_ACTIVE;
 
-    if (::write(socket, &buffer, sizeof(struct can_frame)) < 0) {
-        logger(ERROR) << "Impossible d'écrire dans le buffer";
-        printError(logger);
-        return {CAN_ERROR};
+#ifdef CAN_ERR_CNT
+    if (buffer.can_id & CAN_ERR_CNT) {
+        counters.txErrorCounter.store(buffer.data[6], relaxed);
+        counters.rxErrorCounter.store(buffer.data[7], relaxed);
+    }
+#endif
+
+    if (state != previous) {
+        counters.state.store(state, relaxed);
+        static const char *names[] = {"actif", "avertissement", "passif", "bus-off"};
+        logger(state == CAN_STATE_ACTIVE ? INFO : ERROR) << "État du contrôleur " << interfaceName << " : " << names[state] << std::endl;
     }
+}
 
-    logger(INFO) << "Message envoyé : " << std::showbase << std::hex << buffer.can_id << std::endl;
-    if (timeout == 0)
-        return {CAN_OK};
 
-    auto start = std::chrono::steady_clock::now();
-    std::chrono::milliseconds timeoutMs(timeout*1000);
+uint64_t CAN::interfaceBits() {
+    // Les compteurs du noyau voient toutes les trames du bus, même celles écartées par nos filtres.
+    // Estimation : ~80 bits par trame étendue (en-tête, CRC, espacement, bourrage) + 10 bits par octet de données
+    static const std::pair<const char *, int> statistics[] = {
+        {"rx_packets", 80}, {"tx_packets", 80}, {"rx_bytes", 10}, {"tx_bytes", 10}
+    };
+    uint64_t bits = 0;
 
-    while (std::chrono::steady_clock::now() - start < timeoutMs) {
-        std::lock_guard<std::mutex> lock(mutex);
-        auto response = responses.find(MessageID);
+    for (const auto &[name, weight] : statistics) {
+        std::string path = "/sys/class/net/" + interfaceName + "/statistics/" + name;
+        FILE *file = fopen(path.c_str(), "r");
+        unsigned long long value = 0;
 
-        // Si on a reçu une réponse, on la supprime de la liste et on la retourne
-        if (response != responses.end()) {
-            responses.erase(response);
-            return {CAN_OK, response->second};
+        if (file != nullptr) {
+            if (fscanf(file, "%llu", &value) != 1)
+                value = 0;
+            fclose(file);
         }
+
+        bits += value * weight;
     }
 
-    // Aucune réponse reçue à temps
-    return {CAN_TIMEOUT};
+    return bits;
 }
 
 
-void CAN::bind(uint16_t FunctionCode, can_callback_t callback) {
-    callbacks[FunctionCode] = callback;
+can_stats_t CAN::stats() {
+    constexpr auto relaxed = std::memory_order_relaxed;
+    can_stats_t stats;
+
+    stats.state = counters.state.load(relaxed);
+    stats.txErrorCounter = counters.txErrorCounter.load(relaxed);
+    stats.rxErrorCounter = counters.rxErrorCounter.load(relaxed);
+    stats.errorFrames = counters.errorFrames.load(relaxed);
+    stats.busOff = counters.busOff.load(relaxed);
+    stats.arbitrationLost = counters.arbitrationLost.load(relaxed);
+    stats.protocolErrors = counters.protocolErrors.load(relaxed);
+    stats.ackErrors = counters.ackErrors.load(relaxed);
+    stats.overflows = counters.overflows.load(relaxed);
+    stats.duplicateRequests = counters.duplicateRequests.load(relaxed);
+    stats.retransmissions = counters.retransmissions.load(relaxed);
+    stats.acknowledgements = counters.acknowledgements.load(relaxed);
+    stats.recoveredRequests = counters.recoveredRequests.load(relaxed);
+    stats.exhaustedRequests = counters.exhaustedRequests.load(relaxed);
+    stats.queueOverflows = rxQueue ? rxQueue->dropped() : 0;
+    stats.rxReads = counters.rxReads.load(relaxed);
+    stats.txDropped = counters.txDropped.load(relaxed) + (scheduler ? scheduler->dropped() : 0);
+    stats.txExpired = counters.txExpired.load(relaxed) + (scheduler ? scheduler->expired() : 0);
+    stats.txRejected = counters.txRejected.load(relaxed) + (scheduler ? scheduler->rejected() : 0);
+
+    for (int i = 0; i < CAN_ADDRESS_COUNT; i++) {
+        stats.rxFrames[i] = counters.rxFrames[i].load(relaxed);
+        stats.timeouts[i] = counters.timeouts[i].load(relaxed);
+        stats.txErrors[i] = counters.txErrors[i].load(relaxed);
+    }
+
+    // Charge du bus sur l'intervalle depuis l'appel précédent (0 au premier appel)
+    uint64_t bits = interfaceBits();
+    auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    std::chrono::duration<double> elapsed = now - lastStats;
+
+    // (compteurs remis à zéro si l'interface a redémarré)
+    if (lastStats != std::chrono::steady_clock::time_point{} && elapsed.count() > 0 && bitrate > 0 && bits >= lastBits)
+        stats.busLoad = std::min(1.0, (double) (bits - lastBits) / (elapsed.count() * bitrate));
+
+    lastBits = bits;
+    lastStats = now;
+    return stats;
 }
 
 
-CAN::~CAN() {
-    // On arrête l'écoute du bus CAN que si elle a été démarrée
-    if (listenerThread == nullptr)
+int CAN::setBatchSize(int size) {
+    if (size < 1 || size > CAN_MAX_BATCH) {
+        logger(WARNING) << "Taille de lot invalide : " << size << " (max " << CAN_MAX_BATCH << ")" << std::endl;
+        return -1;
+    }
+
+    if (isListening) {
+        logger(WARNING) << "La taille de lot doit être choisie avant startListening()" << std::endl;
+        return -1;
+    }
+
+    batchSize = size;
+    return 0;
+}
+
+
+void CAN::processFrame(const CanBus_FrameFormat &frame) {
+    counters.rxFrames[frame.SenderAddress].fetch_add(1, std::memory_order_relaxed);
+
+    // On affiche le message et on le traite
+    if (logFrames)
+        print(frame);
+
+    // Si c'est une réponse, on réveille la requête qui l'attend
+    if (frame.IsResp) {
+        completeRequest(frame);
+        return;
+    }
+
+    // Requête répétée par l'émetteur (timeout de son côté) : le callback n'est pas rappelé
+    if (responseCache && replayResponse(frame))
+        return;
+
+    // Les réponses ci-dessus ne passent jamais par la file ni par le pool de threads
+    if (rxQueue)
+        rxQueue->push(frame);
+    else if (dispatcher)
+        dispatcher->post(frame);
+    else
+        dispatch(frame);
+}
+
+
+void CAN::dispatch(const CanBus_FrameFormat &frame) {
+    // FunctionCode vient d'un champ masqué de l'identifiant, il est toujours dans la table.
+    // La copie locale garde le callback en vie si bind() le remplace pendant l'appel
+    std::shared_ptr<const can_callback_t> callback;
+    {
+        std::lock_guard<std::mutex> lock(callbackMutex);
+        callback = callbacks[frame.FunctionCode];
+    }
+
+    if (callback) {
+        (*callback)(*this, frame);
+        return;
+    }
+
+    logger(WARNING) << "Aucun callback pour le code fonction " << (int) frame.FunctionCode << std::endl;
+}
+
+
+int CAN::setRecorder(CanRecorder *recorder) {
+    // Le thread d'écoute utilise recorder sans verrou : il doit rester valide jusqu'à la fin de l'écoute
+    if (isListening) {
+        logger(WARNING) << "L'enregistreur doit être configuré avant startListening()" << std::endl;
+        return -1;
+    }
+
+    this->recorder = recorder;
+    return 0;
+}
+
+
+int CAN::setResponseCache(std::chrono::milliseconds window) {
+    // Le thread d'écoute lit responseCache sans verrou
+    if (isListening) {
+        logger(WARNING) << "Le cache des réponses doit être configuré avant startListening()" << std::endl;
+        return -1;
+    }
+
+    // Les ID message tournent sur 16 valeurs : la fenêtre doit rester plus courte que le temps
+    // qu'il faut à un émetteur pour réutiliser un ID, sinon une nouvelle requête identique serait ignorée
+    cacheWindow = window;
+    responseCache = window > std::chrono::milliseconds::zero() ? std::make_unique<can_response_cache_t>() : nullptr;
+    return 0;
+}
+
+
+bool CAN::replayResponse(const CanBus_FrameFormat &frame) {
+    auto now = std::chrono::steady_clock::now();
+    canfd_frame response;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        can_cached_response_t &entry = (*responseCache)[frame.SenderAddress][frame.MessageID];
+
+        bool duplicate = entry.used && now - entry.time < cacheWindow && entry.FunctionCode == frame.FunctionCode &&
+                         entry.Length == frame.Length && memcmp(entry.Data, frame.Data, frame.Length) == 0;
+
+        // Nouvelle requête : elle remplace la précédente et passe au callback
+        if (!duplicate) {
+            entry.used = true;
+            entry.answered = false;
+            entry.time = now;
+            entry.FunctionCode = frame.FunctionCode;
+            entry.Length = frame.Length;
+            memcpy(entry.Data, frame.Data, frame.Length);
+            return false;
+        }
+
+        counters.duplicateRequests.fetch_add(1, std::memory_order_relaxed);
+
+        // Le callback n'a pas encore répondu : sa réponse servira aussi pour cette répétition
+        if (!entry.answered)
+            return true;
+
+        response = entry.response;
+    }
+
+    if (logFrames)
+        logger(INFO) << "Requête répétée par " << (int) frame.SenderAddress << " (ID message " << (int) frame.MessageID
+                     << "), réponse renvoyée" << std::endl;
+
+    transmit(response);
+    return true;
+}
+
+
+void CAN::cacheResponse(const canfd_frame &buffer) {
+    can_id_fields_t id = canIdDecode(buffer.can_id);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    can_cached_response_t &entry = (*responseCache)[id.ReceiverAddress][id.MessageID];
+
+    // Seule la première réponse à la requête en cours est gardée
+    if (!entry.used || entry.answered || entry.FunctionCode != id.FunctionCode)
         return;
 
-    isListening.store(false);
-    listenerThread->join();
-    ::close(socket);
-    logger(INFO) << "Arrêt de l'écoute CAN" << std::endl;
+    entry.response = buffer;
+    entry.answered = true;
+    entry.time = std::chrono::steady_clock::now();
+}
+
+
+int CAN::readBuffer(CanBus_FrameFormat &frame, const canfd_frame &buffer, size_t size) {
+    // La taille lue sur le socket indique s'il s'agit d'une trame classique ou FD
+    if (size != CAN_MTU && size != CANFD_MTU) {
+        logger(WARNING) << "Taille de trame inattendue : " << size << std::endl;
+        return -1;
+    }
+
+    // len = taille des données (8 octets maximum en CAN classique)
+    frame.IsFD = size == CANFD_MTU;
+    if (buffer.len > (frame.IsFD ? CANFD_MAX_DLEN : CAN_MAX_DLEN)) {
+        logger(WARNING) << "Taille du message trop grande : " << (int) buffer.len << std::endl;
+        return -1;
+    }
+
+    // Décodage de tous les champs de l'identifiant (sans branchement, voir can_id.h)
+    can_id_fields_t id = canIdDecode(buffer.can_id);
+
+    if (address != id.ReceiverAddress && id.ReceiverAddress != CANBUS_BROADCAST) {
+        return -1;
+    }
+
+    frame.ReceiverAddress = id.ReceiverAddress;
+    frame.Priority        = id.Priority;
+    frame.SenderAddress   = id.SenderAddress;
+    frame.FunctionMode    = id.FunctionMode;
+    frame.FunctionCode    = id.FunctionCode;
+    frame.MessageID       = id.MessageID;
+    frame.IsResp          = id.IsResp;
+
+    // Copie des données
+    frame.BitRateSwitch = frame.IsFD && (buffer.flags & CANFD_BRS);
+    frame.Length = buffer.len;
+    memcpy(frame.Data, buffer.data, buffer.len);
+
+    return 0;
+}
+
+
+uint32_t CAN::pendingKey(uint8_t sender, uint16_t FunctionCode, uint8_t MessageID) {
+    return (uint32_t) sender << 24 | (uint32_t) FunctionCode << 8 | MessageID;
+}
+
+
+void CAN::setIdPolicy(can_id_policy_t policy) {
+    std::lock_guard<std::mutex> lock(mutex);
+    idPolicy = policy;
+}
+
+
+std::shared_ptr<can_pending_t> CAN::makeRequest(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, std::span<const uint8_t> Data,
+        uint8_t MessageID, std::chrono::steady_clock::time_point deadline
+) {
+    auto request = std::make_shared<can_pending_t>();
+
+    if (buildFrame(request->buffer, Priority, dest, FunctionMode, FunctionCode, Data, MessageID, false) < 0)
+        return nullptr;
+
+    request->dest = dest & (CAN_ADDRESS_COUNT - 1);
+    request->FunctionCode = FunctionCode;
+    request->MessageID = MessageID;
+    request->deadline = deadline;
+    request->attemptDeadline = deadline;
+    return request;
+}
+
+
+// Attente après l'envoi suivant
+static std::chrono::nanoseconds backoffTimeout(const can_retry_policy_t &retry, std::chrono::nanoseconds timeout) {
+    if (retry.backoff == CAN_BACKOFF_FIXED)
+        return timeout;
+
+    timeout *= 2;
+    return retry.maxTimeout > std::chrono::nanoseconds::zero() ? std::min(timeout, retry.maxTimeout) : timeout;
+}
+
+
+// Prépare le renvoi d'une requête (appelé avec CAN::mutex verrouillé)
+static void nextAttempt(const std::shared_ptr<can_pending_t> &request, std::chrono::steady_clock::time_point now) {
+    request->attempts++;
+    request->attemptTimeout = backoffTimeout(request->retry, request->attemptTimeout);
+
+    // Après le dernier renvoi, la réponse est attendue jusqu'à l'échéance totale
+    request->attemptDeadline = request->attempts < request->retry.retries
+            ? std::min(now + request->attemptTimeout, request->deadline)
+            : request->deadline;
+}
+
+
+std::shared_ptr<can_pending_t> CAN::makeRetryRequest(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, std::span<const uint8_t> Data,
+        const can_retry_policy_t &retry
+) {
+    if (retry.retries < 0 || retry.timeout <= std::chrono::nanoseconds::zero()) {
+        logger(WARNING) << "Politique de renvoi invalide (" << retry.retries << " renvoi(s), attente de "
+                        << retry.timeout.count() << " ns)" << std::endl;
+        return nullptr;
+    }
+
+    // Sans durée totale, on laisse le temps à tous les envois
+    std::chrono::nanoseconds total = retry.deadline;
+    if (total <= std::chrono::nanoseconds::zero()) {
+        std::chrono::nanoseconds timeout = retry.timeout;
+        for (int i = 0; i <= retry.retries; i++) {
+            total += timeout;
+            timeout = backoffTimeout(retry, timeout);
+        }
+    }
+
+    auto request = makeRequest(Priority, dest, FunctionMode, FunctionCode, Data, 0, std::chrono::steady_clock::now() + total);
+    if (request == nullptr)
+        return nullptr;
+
+    request->retry = retry;
+    request->attemptTimeout = retry.timeout;
+    return request;
+}
+
+
+int CAN::allocateId(uint8_t dest) {
+    // Tourniquet : on évite de réutiliser tout de suite un ID (réponse tardive d'une requête expirée)
+    for (int i = 0; i < CAN_MESSAGE_ID_COUNT; i++) {
+        int id = (nextId[dest] + i) % CAN_MESSAGE_ID_COUNT;
+
+        if (inFlight[dest][id] == 0) {
+            nextId[dest] = (id + 1) % CAN_MESSAGE_ID_COUNT;
+            return id;
+        }
+    }
+
+    return -1;
+}
+
+
+void CAN::registerRequest(const std::shared_ptr<can_pending_t> &request) {
+    request->registered = true;
+    inFlight[request->dest][request->MessageID]++;
+
+    // Le délai avant le premier renvoi part d'ici, juste avant l'émission
+    if (request->retry.retries > 0 && !request->acknowledged)
+        request->attemptDeadline = std::min(std::chrono::steady_clock::now() + request->attemptTimeout, request->deadline);
+
+    // Échéance plus proche que celle attendue par le thread d'écoute => on le réveille
+    if (request->attemptDeadline < nextDeadline) {
+        nextDeadline = request->attemptDeadline;
+        wake();
+    }
+}
+
+
+void CAN::assignId(const std::shared_ptr<can_pending_t> &request, uint8_t MessageID) {
+    request->MessageID = MessageID;
+    request->buffer.can_id = (request->buffer.can_id & ~CAN_FIELD_MESSAGE_ID.mask()) | CAN_FIELD_MESSAGE_ID.encode(MessageID);
+}
+
+
+can_status_t CAN::submitRequest(const std::shared_ptr<can_pending_t> &request, bool allocate) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (closing)
+            return CAN_ERROR;
+
+        if (allocate) {
+            int id = allocateId(request->dest);
+
+            // Les 16 ID de cette destination sont utilisés, on applique la politique choisie.
+            // Une requête asynchrone (onComplete) ne bloque jamais son appelant : CAN_ID_BLOCK devient CAN_ID_QUEUE
+            can_id_policy_t policy = idPolicy == CAN_ID_BLOCK && request->onComplete ? CAN_ID_QUEUE : idPolicy;
+
+            if (id < 0) {
+                switch (policy) {
+                    case CAN_ID_FAIL:
+                        lock.unlock();
+                        logger(WARNING) << "Aucun ID message libre pour l'adresse " << (int) request->dest << std::endl;
+                        return CAN_ERROR;
+
+                    case CAN_ID_QUEUE:
+                        queued[request->dest].push_back(request);
+                        if (request->deadline < nextDeadline) {
+                            nextDeadline = request->deadline;
+                            wake();
+                        }
+                        return CAN_OK;
+
+                    case CAN_ID_BLOCK: {
+                        // Les ID sont libérés par les réponses, lues par le thread d'écoute (voir CanDispatcher::enterWait)
+                        bool worker = dispatcher && dispatcher->isWorker();
+                        if (worker)
+                            dispatcher->enterWait();
+
+                        bool allocated = idCv.wait_until(lock, request->deadline, [&] { return closing || (id = allocateId(request->dest)) >= 0; });
+                        if (worker)
+                            dispatcher->leaveWait();
+
+                        if (!allocated)
+                            return CAN_TIMEOUT;
+                        if (closing)
+                            return CAN_ERROR;
+                        break;
+                    }
+                }
+            }
+
+            assignId(request, id);
+        }
+
+        // La requête est enregistrée avant l'envoi pour ne pas rater une réponse rapide
+        uint32_t key = pendingKey(request->dest, request->FunctionCode, request->MessageID);
+        if (!pending.emplace(key, request).second) {
+            lock.unlock();
+            logger(WARNING) << "Une requête avec l'ID message " << (int) request->MessageID << " est déjà en attente" << std::endl;
+            return CAN_ERROR;
+        }
+
+        registerRequest(request);
+    }
+
+    // Une erreur d'envoi termine la requête (CAN_ERROR) dans launchRequests
+    launchRequests({request});
+    return CAN_OK;
+}
+
+
+void CAN::launchRequests(const std::vector<std::shared_ptr<can_pending_t>> &ready) {
+    for (const auto &request : ready) {
+        if (transmit(request->buffer) == 0)
+            continue;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.erase(pendingKey(request->dest, request->FunctionCode, request->MessageID));
+        }
+
+        finishRequest(request, {CAN_ERROR});
+    }
+}
+
+
+void CAN::releaseRequest(const std::shared_ptr<can_pending_t> &request, std::vector<std::shared_ptr<can_pending_t>> &ready) {
+    uint8_t dest = request->dest;
+    request->registered = false;
+    inFlight[dest][request->MessageID]--;
+    idCv.notify_all();
+
+    // L'ID libéré sert directement aux requêtes en file (CAN_ID_QUEUE)
+    int id;
+    while (!queued[dest].empty() && (id = allocateId(dest)) >= 0) {
+        auto next = queued[dest].front();
+        queued[dest].pop_front();
+
+        assignId(next, id);
+        pending.emplace(pendingKey(dest, next->FunctionCode, next->MessageID), next);
+        registerRequest(next);
+        ready.push_back(next);
+    }
+}
+
+
+void CAN::completeRequest(const CanBus_FrameFormat &frame) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Une requête en broadcast accepte la réponse de n'importe quel noeud
+    auto request = pending.find(pendingKey(frame.SenderAddress, frame.FunctionCode, frame.MessageID));
+    if (request == pending.end())
+        request = pending.find(pendingKey(CANBUS_BROADCAST, frame.FunctionCode, frame.MessageID));
+
+    if (request == pending.end()) {
+        // Accusé de réception d'une requête en cours : elle n'est pas terminée, mais plus renvoyée
+        if (frame.FunctionCode == FCT_ACCUSER_RECEPTION && acknowledgeRequest(frame))
+            return;
+
+        lock.unlock();
+        logger(WARNING) << "Réponse sans requête en attente (ID message " << (int) frame.MessageID << ")" << std::endl;
+        return;
+    }
+
+    auto completed = request->second;
+    pending.erase(request);
+    lock.unlock();
+
+    finishRequest(completed, {CAN_OK, frame});
+}
+
+
+bool CAN::acknowledgeRequest(const CanBus_FrameFormat &frame) {
+    // Appelé avec mutex verrouillé. L'accusé n'indique pas le code fonction de la requête : on cherche
+    // une requête vers cet émetteur avec le même ID message, qui attend un accusé (can_retry_policy_t::acknowledge)
+    for (auto &[key, request] : pending) {
+        if (!request->retry.acknowledge || request->acknowledged || request->MessageID != frame.MessageID ||
+            (request->dest != frame.SenderAddress && request->dest != CANBUS_BROADCAST))
+            continue;
+
+        request->acknowledged = true;
+        request->attemptDeadline = request->deadline;
+        counters.acknowledgements.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    return false;
+}
+
+
+void CAN::confirmRequest(const canfd_frame &buffer, uint64_t timestamp) {
+    if (CAN_FIELD_IS_RESPONSE.decode(buffer.can_id))
+        return;
+
+    uint8_t dest = CAN_FIELD_RECEIVER_ADDR.decode(buffer.can_id);
+    uint16_t FunctionCode = CAN_FIELD_FUNCTION_CODE.decode(buffer.can_id);
+    uint8_t MessageID = CAN_FIELD_MESSAGE_ID.decode(buffer.can_id);
+
+    // La trame est bien partie sur le bus : on note l'heure d'émission de la requête
+    std::lock_guard<std::mutex> lock(mutex);
+    auto request = pending.find(pendingKey(dest, FunctionCode, MessageID));
+    if (request != pending.end())
+        request->second->TxTimestamp = timestamp;
+}
+
+
+void CAN::finishRequest(const std::shared_ptr<can_pending_t> &request, const can_result_t &result) {
+    // La requête a déjà été retirée de pending (ou de la file), personne d'autre ne peut la compléter
+    std::vector<std::shared_ptr<can_pending_t>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        request->result = result;
+        request->result.TxTimestamp = request->TxTimestamp;
+
+        if (result.status == CAN_TIMEOUT)
+            counters.timeouts[request->dest].fetch_add(1, std::memory_order_relaxed);
+
+        // Issue des requêtes renvoyées au moins une fois
+        if (request->attempts > 0 && result.status == CAN_OK)
+            counters.recoveredRequests.fetch_add(1, std::memory_order_relaxed);
+        else if (request->attempts > 0 && result.status == CAN_TIMEOUT)
+            counters.exhaustedRequests.fetch_add(1, std::memory_order_relaxed);
+
+        request->done = true;
+
+        if (request->registered)
+            releaseRequest(request, ready);
+    }
+
+    launchRequests(ready);
+
+    // Le callback est appelé sans verrou pour qu'il puisse lui-même envoyer des requêtes
+    if (request->onComplete)
+        request->onComplete(result);
+    else
+        request->cv.notify_one();
+}
+
+
+void CAN::expireRequests() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<can_pending_t>> expired;
+    std::vector<std::shared_ptr<can_pending_t>> retransmit;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (now < nextDeadline)
+            return;
+
+        // On retire les requêtes expirées et on recalcule la prochaine échéance
+        nextDeadline = std::chrono::steady_clock::time_point::max();
+
+        for (auto it = pending.begin(); it != pending.end();) {
+            const auto &request = it->second;
+
+            // Pas de réponse à cet envoi mais il reste du temps (attemptDeadline < deadline) : on renvoie
+            if (request->attemptDeadline <= now && request->deadline > now) {
+                nextAttempt(request, now);
+                retransmit.push_back(request);
+            } else if (request->attemptDeadline <= now) {
+                expired.push_back(request);
+                it = pending.erase(it);
+                continue;
+            }
+
+            nextDeadline = std::min(nextDeadline, request->attemptDeadline);
+            it++;
+        }
+
+        // Requêtes en attente d'un ID message (CAN_ID_QUEUE)
+        for (auto &queue : queued) {
+            for (auto it = queue.begin(); it != queue.end();) {
+                if ((*it)->deadline <= now) {
+                    expired.push_back(*it);
+                    it = queue.erase(it);
+                    continue;
+                }
+
+                nextDeadline = std::min(nextDeadline, (*it)->deadline);
+                it++;
+            }
+        }
+    }
+
+    // Même trame, même ID message : la cible peut reconnaître la répétition (setResponseCache)
+    for (const auto &request : retransmit) {
+        counters.retransmissions.fetch_add(1, std::memory_order_relaxed);
+        if (transmit(request->buffer) < 0)
+            logger(WARNING) << "Échec du renvoi de la requête (ID message " << (int) request->MessageID << ")" << std::endl;
+    }
+
+    for (const auto &request : expired)
+        finishRequest(request, {CAN_TIMEOUT});
+}
+
+
+void CAN::failRequests() {
+    std::vector<std::shared_ptr<can_pending_t>> failed;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+        idCv.notify_all();
+
+        // Les requêtes en file d'abord : un ID libéré ne doit plus en lancer aucune (releaseRequest)
+        for (auto &queue : queued) {
+            failed.insert(failed.end(), queue.begin(), queue.end());
+            queue.clear();
+        }
+
+        for (const auto &[key, request] : pending)
+            failed.push_back(request);
+        pending.clear();
+    }
+
+    // Futures et coroutines sont complétés (CAN_ERROR) plutôt qu'abandonnés (broken_promise, coroutine jamais reprise)
+    for (const auto &request : failed)
+        finishRequest(request, {CAN_ERROR});
+}
+
+
+int CAN::nextTimeout() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (nextDeadline == std::chrono::steady_clock::time_point::max())
+        return -1;
+
+    // Arrondi à la milliseconde supérieure pour ne pas se réveiller juste avant l'échéance
+    auto remaining = std::chrono::ceil<std::chrono::milliseconds>(nextDeadline - std::chrono::steady_clock::now());
+    return (int) std::max<int64_t>(remaining.count(), 0);
+}
+
+
+can_result_t CAN::waitRequest(const std::shared_ptr<can_pending_t> &request) {
+    auto isDone = [&request] { return request->done; };
+
+    // Depuis un thread de callback : le thread d'écoute ne doit pas rester bloqué sur sa file (CAN_OVERFLOW_BLOCK)
+    bool worker = dispatcher && dispatcher->isWorker();
+    if (worker)
+        dispatcher->enterWait();
+
+    // On dort jusqu'à ce que le thread d'écoute complète la requête (réponse ou échéance dépassée)
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!request->cv.wait_until(lock, request->deadline, isDone)) {
+        // Thread d'écoute non démarré : on expire nous-même la requête
+        lock.unlock();
+        expireRequests();
+        lock.lock();
+        request->cv.wait(lock, isDone);
+    }
+
+    can_result_t result = request->result;
+    lock.unlock();
+
+    if (worker)
+        dispatcher->leaveWait();
+
+    return result;
+}
+
+
+int CAN::transmit(const canfd_frame &buffer) {
+    // Avec l'ordonnanceur, la trame est mise en file et envoyée par son thread
+    if (scheduler) {
+        // File pleine : pas de log par trame (il alloue et ignorerait setFrameLogging), le refus est compté dans txRejected
+        return scheduler->push(buffer) ? 0 : -1;
+    }
+
+    if (::write(socket, &buffer, canMtu(buffer)) < 0) {
+        counters.txErrors[CAN_FIELD_RECEIVER_ADDR.decode(buffer.can_id)].fetch_add(1, std::memory_order_relaxed);
+        logger(ERROR) << "Impossible d'écrire dans le buffer";
+        printError(logger);
+        return -1;
+    }
+
+    if (logFrames)
+        logger(INFO) << "Message envoyé : " << std::showbase << std::hex << buffer.can_id << std::dec << std::endl;
+
+    return 0;
+}
+
+
+can_result_t CAN::send(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &Data,
+        uint8_t MessageID, bool IsResp, int timeout // timeout en secondes si on attend une réponse
+) {
+    return send(Priority, dest, FunctionMode, FunctionCode, Data, MessageID, IsResp, std::chrono::seconds(timeout));
+}
+
+
+can_result_t CAN::send(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &Data,
+        uint8_t MessageID, bool IsResp, std::chrono::nanoseconds timeout // timeout si on attend une réponse
+) {
+    if (timeout > std::chrono::nanoseconds::zero())
+        return send(Priority, dest, FunctionMode, FunctionCode, Data, MessageID, IsResp, std::chrono::steady_clock::now() + timeout);
+
+    // Sans timeout, on n'attend pas de réponse
+    return send(Priority, dest, FunctionMode, FunctionCode, std::span<const uint8_t>(Data), MessageID, IsResp);
+}
+
+
+can_result_t CAN::send(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, std::span<const uint8_t> Data,
+        uint8_t MessageID, bool IsResp
+) {
+    // Chemin sans attente de réponse. Sans allocation seulement avec setFrameLogging(false) et CAN_TX_DIRECT
+    // (vérifié par CAN_bench) : l'ordonnanceur n'alloue pas dans l'appel, mais ses logs sont écrits par son thread.
+    // Une trame refusée (file pleine, erreur du noyau) est toujours loggée, donc alloue
+    canfd_frame buffer{};
+    if (buildFrame(buffer, Priority, dest, FunctionMode, FunctionCode, Data, MessageID, IsResp) < 0)
+        return {CAN_ERROR};
+
+    // Réponse gardée pour les répétitions de la requête (setResponseCache)
+    if (IsResp && responseCache)
+        cacheResponse(buffer);
+
+    return {transmit(buffer) < 0 ? CAN_ERROR : CAN_OK};
+}
+
+
+can_result_t CAN::send(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &Data,
+        uint8_t MessageID, bool IsResp, std::chrono::steady_clock::time_point deadline // échéance de la réponse
+) {
+    auto request = makeRequest(Priority, dest, FunctionMode, FunctionCode, Data, MessageID, deadline);
+    if (request == nullptr)
+        return {CAN_ERROR};
+
+    request->buffer.can_id |= IsResp;
+
+    can_status_t status = submitRequest(request, false);
+    if (status != CAN_OK)
+        return {status};
+
+    return waitRequest(request);
+}
+
+
+can_result_t CAN::send(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &Data,
+        std::chrono::nanoseconds timeout // ID message alloué automatiquement
+) {
+    auto request = makeRequest(Priority, dest, FunctionMode, FunctionCode, Data, 0, std::chrono::steady_clock::now() + timeout);
+    if (request == nullptr)
+        return {CAN_ERROR};
+
+    can_status_t status = submitRequest(request, true);
+    if (status != CAN_OK)
+        return {status};
+
+    return waitRequest(request);
+}
+
+
+can_result_t CAN::send(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &Data,
+        const can_retry_policy_t &retry // ID message alloué automatiquement, renvois sans réponse
+) {
+    auto request = makeRetryRequest(Priority, dest, FunctionMode, FunctionCode, Data, retry);
+    if (request == nullptr)
+        return {CAN_ERROR};
+
+    can_status_t status = submitRequest(request, true);
+    if (status != CAN_OK)
+        return {status};
+
+    return waitRequest(request);
+}
+
+
+can_result_t CAN::acknowledge(const CanBus_FrameFormat &frame) {
+    // Côté cible : accusé de réception immédiat, la vraie réponse suit une fois la requête traitée
+    return send<FCT_ACCUSER_RECEPTION>(
+        (CanBus_Priority) frame.Priority, (CanBus_Address) frame.SenderAddress, (CanBus_Fnct_Mode) frame.FunctionMode,
+        {CAN_ACK}, frame.MessageID, true
+    );
+}
+
+
+std::future<can_result_t> CAN::sendAsync(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &Data,
+        uint8_t MessageID, std::chrono::nanoseconds timeout
+) {
+    auto promise = std::make_shared<std::promise<can_result_t>>();
+    auto future = promise->get_future();
+
+    sendAsync(Priority, dest, FunctionMode, FunctionCode, Data, MessageID, timeout, [promise](const can_result_t &result) {
+        promise->set_value(result);
+    });
+
+    return future;
+}
+
+
+std::future<can_result_t> CAN::sendAsync(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &Data,
+        std::chrono::nanoseconds timeout // ID message alloué automatiquement
+) {
+    auto promise = std::make_shared<std::promise<can_result_t>>();
+    auto future = promise->get_future();
+
+    sendAsync(Priority, dest, FunctionMode, FunctionCode, Data, timeout, [promise](const can_result_t &result) {
+        promise->set_value(result);
+    });
+
+    return future;
+}
+
+
+void CAN::sendAsync(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &Data,
+        uint8_t MessageID, std::chrono::nanoseconds timeout, can_completion_t onComplete
+) {
+    startAsync(
+        makeRequest(Priority, dest, FunctionMode, FunctionCode, Data, MessageID, std::chrono::steady_clock::now() + timeout),
+        false, std::move(onComplete)
+    );
+}
+
+
+void CAN::sendAsync(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &Data,
+        std::chrono::nanoseconds timeout, can_completion_t onComplete // ID message alloué automatiquement
+) {
+    startAsync(
+        makeRequest(Priority, dest, FunctionMode, FunctionCode, Data, 0, std::chrono::steady_clock::now() + timeout),
+        true, std::move(onComplete)
+    );
+}
+
+
+void CAN::sendAsync(
+        CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode, const std::vector<uint8_t> &Data,
+        const can_retry_policy_t &retry, can_completion_t onComplete // ID message alloué automatiquement, renvois sans réponse
+) {
+    startAsync(makeRetryRequest(Priority, dest, FunctionMode, FunctionCode, Data, retry), true, std::move(onComplete));
+}
+
+
+void CAN::startAsync(const std::shared_ptr<can_pending_t> &request, bool allocate, can_completion_t onComplete) {
+    // En cas d'erreur immédiate, onComplete est appelé dans le thread appelant,
+    // sinon il l'est dans le thread d'écoute à la réception de la réponse ou à l'échéance
+    if (request == nullptr) {
+        onComplete({CAN_ERROR});
+        return;
+    }
+
+    request->onComplete = std::move(onComplete);
+
+    can_status_t status = submitRequest(request, allocate);
+    if (status != CAN_OK)
+        request->onComplete({status});
+}
+
+
+int CAN::buildFrame(
+        canfd_frame &buffer, CanBus_Priority Priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode,
+        std::span<const uint8_t> Data, uint8_t MessageID, bool IsResp, bool IsFD
+) {
+    // Les messages courts restent en CAN classique pour être compris par tous les noeuds
+    IsFD = IsFD || Data.size() > CAN_MAX_DLEN;
+
+    if (Data.size() > CANFD_MAX_DLEN || (IsFD && !fdFrames)) {
+        logger(WARNING) << "Taille du message trop grande : " << Data.size()
+                        << (fdFrames ? "" : " (CAN FD non activé, voir setFdFrames)") << std::endl;
+        return -1;
+    }
+
+    // Au-delà de 8 octets, seules certaines tailles existent en CAN FD : on complète avec des 0
+    buffer.len = Data.size();
+    if (IsFD) {
+        buffer.flags = CANFD_FDF | (bitRateSwitch ? CANFD_BRS : 0);
+
+        if (buffer.len > CAN_MAX_DLEN) {
+            for (uint8_t length : {12, 16, 20, 24, 32, 48, 64}) {
+                if (buffer.len <= length) {
+                    buffer.len = length;
+                    break;
+                }
+            }
+        }
+    }
+
+    memcpy(buffer.data, Data.data(), Data.size());
+    buffer.can_id = encodeId(Priority, dest, FunctionMode, FunctionCode, MessageID, IsResp);
+    return 0;
+}
+
+
+canid_t CAN::encodeId(
+        uint8_t Priority, uint8_t dest, uint8_t FunctionMode, uint16_t FunctionCode, uint8_t MessageID, bool IsResp
+) const {
+    return canIdEncode(Priority, address, dest, FunctionMode, FunctionCode, MessageID, IsResp) | CAN_EFF_FLAG;
+}
+
+
+std::vector<can_status_t> CAN::sendBatch(const std::vector<CanBus_FrameFormat> &frames) {
+    // Le champ SenderAddress des trames est ignoré, on envoie toujours avec notre adresse
+    std::vector<can_status_t> status(frames.size(), CAN_ERROR);
+
+    // Toutes les trames valides sont encodées dans un seul buffer contigu
+    std::vector<canfd_frame> buffers;
+    std::vector<size_t> indexes;
+    buffers.reserve(frames.size());
+    indexes.reserve(frames.size());
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        const CanBus_FrameFormat &frame = frames[i];
+
+        if (frame.Length > CAN_MAX_DATA_LENGTH) {
+            logger(WARNING) << "Taille du message trop grande : " << (int) frame.Length << std::endl;
+            continue;
+        }
+
+        canfd_frame &buffer = buffers.emplace_back();
+        buffer = {};
+
+        if (buildFrame(
+                buffer, (CanBus_Priority) frame.Priority, (CanBus_Address) frame.ReceiverAddress, (CanBus_Fnct_Mode) frame.FunctionMode,
+                (CanBus_Fnct_Code) frame.FunctionCode, {frame.Data, frame.Length}, frame.MessageID, frame.IsResp, frame.IsFD
+        ) < 0) {
+            buffers.pop_back();
+            continue;
+        }
+
+        indexes.push_back(i);
+    }
+
+    if (scheduler) {
+        for (size_t i = 0; i < buffers.size(); i++)
+            status[indexes[i]] = scheduler->push(buffers[i]) ? CAN_OK : CAN_ERROR;
+
+        return status;
+    }
+
+    std::vector<iovec> iovecs(buffers.size());
+    std::vector<mmsghdr> headers(buffers.size());
+
+    for (size_t i = 0; i < buffers.size(); i++) {
+        iovecs[i] = {&buffers[i], canMtu(buffers[i])};
+        headers[i].msg_hdr.msg_iov = &iovecs[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // La file d'émission du noyau peut être pleine : on renvoie le reste jusqu'à CAN_TX_BUSY_TIMEOUT
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CAN_TX_BUSY_TIMEOUT);
+    size_t sent = 0;
+
+    while (sent < buffers.size()) {
+        int count = ::sendmmsg(socket, &headers[sent], buffers.size() - sent, 0);
+
+        if (count > 0) {
+            for (int i = 0; i < count; i++)
+                status[indexes[sent + i]] = CAN_OK;
+
+            sent += count;
+            continue;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+            printError(logger, ERROR, "Impossible d'envoyer le lot de trames");
+            break;
+        }
+
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+
+        if (remaining.count() <= 0) {
+            for (size_t i = sent; i < buffers.size(); i++)
+                status[indexes[i]] = CAN_TIMEOUT;
+
+            logger(WARNING) << "File d'émission pleine, " << buffers.size() - sent << " trame(s) non envoyée(s)" << std::endl;
+            break;
+        }
+
+        // ENOBUFS ne déclenche pas POLLOUT sur les sockets CAN, on patiente simplement
+        if (errno == ENOBUFS) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        } else {
+            pollfd fd{socket, POLLOUT, 0};
+            ::poll(&fd, 1, (int) remaining.count());
+        }
+    }
+
+    if (logFrames)
+        logger(INFO) << "Lot envoyé : " << sent << "/" << frames.size() << " trame(s)" << std::endl;
+    return status;
+}
+
+
+int CAN::setCallbackWorkers(int workers, size_t queueSize, can_shard_t shard, can_overflow_t overflow) {
+    if (isListening) {
+        logger(WARNING) << "Les threads de callback doivent être configurés avant startListening()" << std::endl;
+        return -1;
+    }
+
+    // 0 thread => retour aux callbacks exécutés dans le thread d'écoute
+    if (workers <= 0) {
+        dispatcher.reset();
+        return 0;
+    }
+
+    if (queueSize == 0) {
+        logger(WARNING) << "La file des threads de callback doit contenir au moins une trame" << std::endl;
+        return -1;
+    }
+
+    dispatcher = std::make_unique<CanDispatcher>(
+        workers, queueSize, shard, overflow, [this](const CanBus_FrameFormat &frame) { dispatch(frame); }
+    );
+    return 0;
+}
+
+
+int CAN::setReceiveQueue(size_t size, can_overflow_t overflow) {
+    // Le thread d'écoute ne doit jamais attendre la boucle de contrôle
+    if (overflow == CAN_OVERFLOW_BLOCK || size == 0) {
+        logger(WARNING) << "File de réception invalide : taille non nulle et CAN_OVERFLOW_DROP_* requis" << std::endl;
+        return -1;
+    }
+
+    // Le thread d'écoute lit rxQueue sans verrou
+    if (isListening) {
+        logger(WARNING) << "La file de réception doit être configurée avant startListening()" << std::endl;
+        return -1;
+    }
+
+    rxQueue = std::make_unique<CanRxQueue>(size, overflow);
+    return 0;
+}
+
+
+size_t CAN::poll(std::span<CanBus_FrameFormat> frames) {
+    // Un seul thread consommateur (la boucle de contrôle) : aucun verrou
+    return rxQueue ? rxQueue->pop(frames) : 0;
+}
+
+
+bool CAN::tryReceive(CanBus_FrameFormat &frame) {
+    return rxQueue && rxQueue->pop(frame);
+}
+
+
+int CAN::setTxScheduler(can_tx_mode_t mode, bool socketPriority) {
+    // À configurer avant les premiers envois : transmit() lit scheduler sans verrou.
+    // En CAN_TX_DIRECT, une trame refusée par le noyau (ENOBUFS, bus saturé ou en bus-off) est abandonnée
+    // et l'envoi renvoie CAN_ERROR ; avec l'ordonnanceur, elle attend en file (setTxQueue) jusqu'à son âge maximum
+    if (socket < 0) {
+        logger(WARNING) << "L'ordonnanceur d'émission doit être configuré après init()" << std::endl;
+        return -1;
+    }
+
+    // Les trames encore en file de l'ancien ordonnanceur sont abandonnées : ses compteurs sont gardés dans les statistiques
+    if (scheduler) {
+        scheduler->stop();
+        counters.txDropped.fetch_add(scheduler->dropped(), std::memory_order_relaxed);
+        counters.txExpired.fetch_add(scheduler->expired(), std::memory_order_relaxed);
+        counters.txRejected.fetch_add(scheduler->rejected(), std::memory_order_relaxed);
+        scheduler.reset();
+    }
+
+    if (mode != CAN_TX_DIRECT) {
+        scheduler = std::make_unique<CanScheduler>(socket, mode, socketPriority, txQueues, counters.txErrors);
+        scheduler->setFrameLogging(logFrames);
+    }
+
+    return 0;
+}
+
+
+int CAN::setTxQueue(CanBus_Priority priority, const can_tx_queue_t &queue) {
+    // Le thread d'émission ne doit pas bloquer les envois (dont ceux du thread d'écoute : renvois, réponses)
+    if (priority >= CAN_PRIORITY_COUNT || queue.size == 0 || queue.overflow == CAN_OVERFLOW_BLOCK) {
+        logger(WARNING) << "File d'émission invalide : taille non nulle et CAN_OVERFLOW_DROP_* requis" << std::endl;
+        return -1;
+    }
+
+    if (scheduler) {
+        logger(WARNING) << "Les files d'émission doivent être configurées avant setTxScheduler()" << std::endl;
+        return -1;
+    }
+
+    txQueues[priority] = queue;
+    return 0;
+}
+
+
+void CAN::setFrameLogging(bool enabled) {
+    logFrames = enabled;
+    if (scheduler)
+        scheduler->setFrameLogging(enabled);
+}
+
+
+int CAN::forward(uint16_t FunctionCode, CAN *target) {
+    // Les trames de ce code fonction reçues sur notre bus sont renvoyées sans modification sur target (nullptr = arrêt).
+    // Le thread d'écoute lit forwards sans verrou : table configurée avant startListening().
+    // target doit rester valide (et son socket ouvert) tant que ce bus est en écoute
+    if (isListening) {
+        logger(WARNING) << "La passerelle doit être configurée avant startListening()" << std::endl;
+        return -1;
+    }
+
+    if (FunctionCode >= CAN_FUNCTION_CODE_COUNT || target == this) {
+        logger(WARNING) << "Relais impossible pour le code fonction " << std::showbase << std::hex << FunctionCode << std::dec << std::endl;
+        return -1;
+    }
+
+    forwardCount += (forwards[FunctionCode] == nullptr) - (target == nullptr);
+    forwards[FunctionCode] = target;
+    return updateFilters();
+}
+
+
+int CAN::bind(uint16_t FunctionCode, can_callback_t callback) {
+    // Un code trop grand pour le champ de l'identifiant ne pourrait jamais être reçu
+    if (FunctionCode >= CAN_FUNCTION_CODE_COUNT) {
+        logger(WARNING) << "Code fonction hors de l'identifiant CAN : " << std::showbase << std::hex
+                        << FunctionCode << " (max " << CAN_FUNCTION_CODE_COUNT - 1 << ")" << std::dec << std::endl;
+        return -1;
+    }
+
+    // Appelable pendant l'écoute, y compris depuis un callback. Un callback remplacé (ou délié avec nullptr)
+    // peut encore terminer un appel en cours dans un autre thread : ce qu'il capture doit lui survivre (shared_ptr)
+    std::lock_guard<std::mutex> lock(bindMutex);
+
+    bool bound = static_cast<bool>(callback);
+    std::shared_ptr<const can_callback_t> previous = bound ? std::make_shared<const can_callback_t>(std::move(callback)) : nullptr;
+    {
+        std::lock_guard<std::mutex> table(callbackMutex);
+        callbacks[FunctionCode].swap(previous);
+    }
+
+    // L'ancien callback est détruit au retour (hors callbackMutex), ou à la fin de son appel en cours
+    boundCount += !previous - !bound;
+
+    // Les filtres noyau dépendent des callbacks liés
+    if (filterFunctions)
+        return updateFilters();
+
+    return 0;
+}
+
+
+CAN::~CAN() {
+    // On arrête l'écoute du bus CAN que si elle a été démarrée
+    if (listenerThread != nullptr) {
+        // L'écriture dans eventFd réveille epoll_wait immédiatement
+        isListening.store(false);
+        ::eventfd_write(eventFd, 1);
+        listenerThread->join();
+        logger(INFO) << "Arrêt de l'écoute CAN" << std::endl;
+    }
+
+    // Après remove(), la boucle partagée n'utilise plus cette instance
+    if (eventLoop != nullptr && isListening)
+        eventLoop->remove(*this);
+
+    // Plus personne ne lira les réponses : les requêtes en attente échouent avant la fermeture du socket
+    failRequests();
+
+    // Les callbacks en cours et les trames en file peuvent encore utiliser le socket
+    dispatcher.reset();
+    scheduler.reset();
+
+    for (int fd : {socket, epollFd, eventFd})
+        if (fd >= 0)
+            ::close(fd);
 }
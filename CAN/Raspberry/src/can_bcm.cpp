@@ -0,0 +1,271 @@
+/*!
+ * @file can_bcm.cpp
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Fichier source de la classe CanBcm
+ */
+
+#include <cstring>
+#include <net/if.h>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <linux/can/bcm.h>
+
+#include "../include/can_bcm.h"
+
+
+// Message échangé avec le BCM : en-tête suivi d'une seule trame (classique ou FD)
+// (bcm_msg_head se termine par un tableau flexible, d'où l'accès par pointeurs)
+struct can_bcm_msg_t {
+    alignas(bcm_msg_head) uint8_t bytes[sizeof(bcm_msg_head) + CANFD_MTU];
+
+    bcm_msg_head &head() { return *(bcm_msg_head *) bytes; }
+    canfd_frame &frame() { return *(canfd_frame *) (bytes + sizeof(bcm_msg_head)); }
+};
+
+
+static bcm_timeval toTimeval(std::chrono::microseconds duration) {
+    return {(long) (duration.count() / 1000000), (long) (duration.count() % 1000000)};
+}
+
+
+int CanBcm::init(CanBus_Address myAddress, const std::string &interface) {
+    address = myAddress;
+    socket = ::socket(PF_CAN, SOCK_DGRAM | SOCK_CLOEXEC, CAN_BCM);
+    eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (socket < 0 || eventFd < 0) {
+        logger(CRITICAL) << "Impossible de créer le socket BCM (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    // Le BCM utilise connect() (et non bind()) pour choisir l'interface
+    sockaddr_can addr{};
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = (int) if_nametoindex(interface.c_str());
+
+    if (addr.can_ifindex == 0 || ::connect(socket, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        logger(CRITICAL) << "Impossible de connecter le socket BCM à " << interface << " (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    isListening = true;
+    listenerThread = std::make_unique<std::thread>(&CanBcm::listen, this);
+    return 0;
+}
+
+
+int CanBcm::setup(
+        uint32_t opcode, uint32_t flags, canid_t id, std::span<const uint8_t> data, uint32_t count,
+        std::chrono::microseconds interval1, std::chrono::microseconds interval2
+) {
+    if (data.size() > CANFD_MAX_DLEN) {
+        logger(WARNING) << "Taille du message trop grande : " << data.size() << std::endl;
+        return -1;
+    }
+
+    can_bcm_msg_t msg{};
+    msg.head().opcode = opcode;
+    msg.head().flags = flags;
+    msg.head().count = count;
+    msg.head().ival1 = toTimeval(interval1);
+    msg.head().ival2 = toTimeval(interval2);
+    msg.head().can_id = id;
+    msg.head().nframes = opcode == TX_DELETE || opcode == RX_DELETE ? 0 : 1;
+
+    msg.frame().can_id = id;
+    msg.frame().len = data.size();
+    memcpy(msg.frame().data, data.data(), data.size());
+
+    // Au-delà de 8 octets, la trame est envoyée en CAN FD (ou si l'appelant l'impose : CAN_FD_FRAME dans flags)
+    if (data.size() > CAN_MAX_DLEN)
+        msg.head().flags |= CAN_FD_FRAME;
+
+    size_t size = sizeof(bcm_msg_head) + msg.head().nframes * (msg.head().flags & CAN_FD_FRAME ? CANFD_MTU : CAN_MTU);
+
+    if (::write(socket, &msg, size) < 0) {
+        logger(ERROR) << "Opération BCM " << opcode << " refusée pour " << std::showbase << std::hex << id << std::dec
+                      << " (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int CanBcm::startPeriodic(
+        CanBus_Priority priority, CanBus_Address dest, CanBus_Fnct_Mode FunctionMode, CanBus_Fnct_Code FunctionCode,
+        std::span<const uint8_t> data, std::chrono::microseconds interval, uint32_t count // count = 0 => sans fin
+) {
+    canid_t id = canIdEncode(priority, address, dest, FunctionMode, FunctionCode) | CAN_EFF_FLAG;
+    uint32_t fd = data.size() > CAN_MAX_DLEN ? CAN_FD_FRAME : 0;
+
+    // count trames à ival1 puis ival2 : ival2 = 0 arrête l'émission après les count trames
+    int status = count > 0
+            ? setup(TX_SETUP, SETTIMER | STARTTIMER | fd, id, data, count, interval, {})
+            : setup(TX_SETUP, SETTIMER | STARTTIMER | fd, id, data, 0, {}, interval);
+
+    if (status < 0)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    periodic[key(dest, FunctionCode)] = {id, fd};
+    return 0;
+}
+
+
+int CanBcm::updatePeriodic(CanBus_Address dest, CanBus_Fnct_Code FunctionCode, std::span<const uint8_t> data) {
+    periodic_t job;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = periodic.find(key(dest, FunctionCode));
+        if (it == periodic.end()) {
+            logger(WARNING) << "Aucune trame périodique pour le code fonction " << (int) FunctionCode << std::endl;
+            return -1;
+        }
+        job = it->second;
+    }
+
+    // Le type de trame ne change pas : une trame classique reste limitée à 8 octets
+    if (!job.fd && data.size() > CAN_MAX_DLEN) {
+        logger(WARNING) << "Trame périodique classique : " << data.size() << " octets, 8 au maximum" << std::endl;
+        return -1;
+    }
+
+    // Sans SETTIMER, le noyau remplace seulement les données : le rythme d'émission n'est pas modifié
+    return setup(TX_SETUP, job.fd, job.id, data);
+}
+
+
+int CanBcm::stopPeriodic(CanBus_Address dest, CanBus_Fnct_Code FunctionCode) {
+    periodic_t job;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = periodic.find(key(dest, FunctionCode));
+        if (it == periodic.end())
+            return -1;
+
+        job = it->second;
+        periodic.erase(it);
+    }
+
+    return setup(TX_DELETE, job.fd, job.id, {});
+}
+
+
+int CanBcm::watch(
+        CanBus_Priority priority, CanBus_Address sender, CanBus_Address receiver, CanBus_Fnct_Mode FunctionMode,
+        CanBus_Fnct_Code FunctionCode, std::chrono::microseconds timeout, can_bcm_callback_t callback // timeout = 0 => pas de détection d'arrêt
+) {
+    canid_t id = canIdEncode(priority, sender, receiver, FunctionMode, FunctionCode) | CAN_EFF_FLAG;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto previous = watched.find(key(sender, FunctionCode));
+        if (previous != watched.end())
+            callbacks.erase(previous->second);
+
+        watched[key(sender, FunctionCode)] = id;
+        callbacks[id] = std::move(callback);
+    }
+
+    // Masque sur tous les octets : seules les trames dont le contenu (ou la taille) change nous sont remontées
+    const uint8_t mask[CAN_MAX_DLEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    uint32_t flags = RX_CHECK_DLC | RX_ANNOUNCE_RESUME;
+    if (timeout.count() > 0)
+        flags |= SETTIMER | STARTTIMER;
+
+    if (setup(RX_SETUP, flags, id, mask, 0, timeout, {}) < 0) {
+        unwatch(sender, FunctionCode);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int CanBcm::unwatch(CanBus_Address sender, CanBus_Fnct_Code FunctionCode) {
+    canid_t id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = watched.find(key(sender, FunctionCode));
+        if (it == watched.end())
+            return -1;
+
+        id = it->second;
+        watched.erase(it);
+        callbacks.erase(id);
+    }
+
+    return setup(RX_DELETE, 0, id, {});
+}
+
+
+void CanBcm::listen() {
+    // Le noyau ne nous réveille que sur changement de contenu (RX_CHANGED) ou sur timeout (RX_TIMEOUT)
+    pollfd fds[2] = {{socket, POLLIN, 0}, {eventFd, POLLIN, 0}};
+    can_bcm_msg_t msg{};
+
+    while (isListening.load()) {
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno != EINTR)
+                logger(ERROR) << "Erreur lors de l'écoute BCM (" << strerror(errno) << ")" << std::endl;
+            continue;
+        }
+
+        if (!(fds[0].revents & POLLIN))
+            continue;
+
+        ssize_t size = ::read(socket, &msg, sizeof(msg));
+        if (size < (ssize_t) sizeof(bcm_msg_head) || (msg.head().opcode != RX_CHANGED && msg.head().opcode != RX_TIMEOUT))
+            continue;
+
+        can_bcm_callback_t callback;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = callbacks.find(msg.head().can_id);
+            if (it == callbacks.end())
+                continue;
+            callback = it->second;
+        }
+
+        // Sur RX_TIMEOUT, seul l'identifiant est renseigné (Length = 0)
+        CanBus_FrameFormat frame{};
+        can_id_fields_t id = canIdDecode(msg.head().can_id);
+        frame.Priority        = id.Priority;
+        frame.SenderAddress   = id.SenderAddress;
+        frame.ReceiverAddress = id.ReceiverAddress;
+        frame.FunctionMode    = id.FunctionMode;
+        frame.FunctionCode    = id.FunctionCode;
+
+        if (msg.head().opcode == RX_CHANGED && msg.head().nframes > 0) {
+            frame.IsFD = msg.head().flags & CAN_FD_FRAME;
+            frame.Length = std::min<uint8_t>(msg.frame().len, frame.IsFD ? CANFD_MAX_DLEN : CAN_MAX_DLEN);
+            memcpy(frame.Data, msg.frame().data, frame.Length);
+        }
+
+        callback(msg.head().opcode == RX_CHANGED ? CAN_OK : CAN_TIMEOUT, frame);
+    }
+}
+
+
+uint32_t CanBcm::key(uint8_t address, uint16_t FunctionCode) {
+    return (uint32_t) address << 16 | FunctionCode;
+}
+
+
+CanBcm::~CanBcm() {
+    // Fermer le socket supprime aussi toutes les trames périodiques et surveillances du noyau
+    if (listenerThread != nullptr) {
+        isListening.store(false);
+        ::eventfd_write(eventFd, 1);
+        listenerThread->join();
+    }
+
+    for (int fd : {socket, eventFd})
+        if (fd >= 0)
+            ::close(fd);
+}
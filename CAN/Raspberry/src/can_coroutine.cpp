@@ -0,0 +1,65 @@
+/*!
+ * @file can_coroutine.cpp
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Fichier source de l'exécuteur CanExecutor
+ */
+
+#include "../include/can_coroutine.h"
+
+
+void CanExecutor::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+
+    cv.notify_one();
+}
+
+
+void CanExecutor::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        cv.wait(lock, [this] { return stopped || !tasks.empty(); });
+        if (stopped)
+            break;
+
+        // La tâche est exécutée sans verrou, elle peut elle-même poster d'autres tâches
+        auto task = std::move(tasks.front());
+        tasks.pop_front();
+
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+
+    stopped = false;
+}
+
+
+int CanExecutor::runOnce() {
+    // Exécute les tâches déjà prêtes sans bloquer (à appeler depuis une boucle de contrôle)
+    std::deque<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.swap(tasks);
+    }
+
+    for (auto &task : ready)
+        task();
+
+    return (int) ready.size();
+}
+
+
+void CanExecutor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+
+    cv.notify_all();
+}
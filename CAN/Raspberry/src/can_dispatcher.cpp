@@ -0,0 +1,121 @@
+/*!
+ * @file can_dispatcher.cpp
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Fichier source de la classe CanDispatcher
+ */
+
+#include "../include/can_dispatcher.h"
+
+
+thread_local CanDispatcher *CanDispatcher::current = nullptr;
+
+
+CanDispatcher::CanDispatcher(
+        int workerCount, size_t queueSize, can_shard_t shard, can_overflow_t overflow,
+        std::function<void(const CanBus_FrameFormat &frame)> handler
+): shard(shard), overflow(overflow), handler(std::move(handler)) {
+    for (int i = 0; i < workerCount; i++) {
+        auto &worker = workers.emplace_back(std::make_unique<worker_t>());
+        worker->ring.resize(queueSize);
+    }
+
+    // Les threads sont démarrés une fois toutes les files créées
+    for (auto &worker : workers)
+        worker->thread = std::thread(&CanDispatcher::run, this, std::ref(*worker));
+}
+
+
+void CanDispatcher::post(const CanBus_FrameFormat &frame) {
+    size_t key = shard == CAN_SHARD_SENDER ? frame.SenderAddress : frame.FunctionCode;
+    worker_t &worker = *workers[key % workers.size()];
+
+    std::unique_lock<std::mutex> lock(worker.mutex);
+
+    if (worker.count == worker.ring.size()) {
+        switch (overflow) {
+            case CAN_OVERFLOW_BLOCK:
+                worker.notFull.wait(lock, [&] { return worker.count < worker.ring.size() || stopping || waiting > 0; });
+                if (stopping)
+                    return;
+
+                // Un worker attend une réponse que seul le thread d'écoute peut lire : on ne bloque pas
+                if (worker.count == worker.ring.size()) {
+                    droppedFrames.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                break;
+
+            case CAN_OVERFLOW_DROP_NEWEST:
+                droppedFrames.fetch_add(1, std::memory_order_relaxed);
+                return;
+
+            case CAN_OVERFLOW_DROP_OLDEST:
+                droppedFrames.fetch_add(1, std::memory_order_relaxed);
+                worker.head = (worker.head + 1) % worker.ring.size();
+                worker.count--;
+                break;
+        }
+    }
+
+    worker.ring[(worker.head + worker.count) % worker.ring.size()] = frame;
+    worker.count++;
+
+    lock.unlock();
+    worker.notEmpty.notify_one();
+}
+
+
+void CanDispatcher::enterWait() {
+    waiting.fetch_add(1);
+
+    // Le thread d'écoute est peut-être déjà bloqué dans post() : on le réveille
+    for (auto &worker : workers) {
+        { std::lock_guard<std::mutex> lock(worker->mutex); }
+        worker->notFull.notify_all();
+    }
+}
+
+
+void CanDispatcher::leaveWait() {
+    waiting.fetch_sub(1);
+}
+
+
+void CanDispatcher::run(worker_t &worker) {
+    CanBus_FrameFormat frame{};
+    current = this;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            worker.notEmpty.wait(lock, [&] { return worker.count > 0 || stopping; });
+
+            // Les trames restantes sont abandonnées à l'arrêt
+            if (stopping)
+                return;
+
+            frame = worker.ring[worker.head];
+            worker.head = (worker.head + 1) % worker.ring.size();
+            worker.count--;
+        }
+
+        worker.notFull.notify_one();
+        handler(frame);
+    }
+}
+
+
+CanDispatcher::~CanDispatcher() {
+    stopping = true;
+
+    for (auto &worker : workers) {
+        // Prendre le verrou garantit que le worker est soit en attente, soit verra stopping
+        { std::lock_guard<std::mutex> lock(worker->mutex); }
+
+        worker->notEmpty.notify_all();
+        worker->notFull.notify_all();
+        worker->thread.join();
+    }
+}
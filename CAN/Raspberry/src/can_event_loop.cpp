@@ -0,0 +1,173 @@
+/*!
+ * @file can_event_loop.cpp
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Fichier source de la classe CanEventLoop
+ */
+
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "../include/can.h"
+#include "../include/can_event_loop.h"
+
+
+CanEventLoop::CanEventLoop() {
+    epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+    eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    // data.ptr = nullptr identifie notre eventFd, les autres pointent vers un CAN
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+
+    // Sans epoll, le thread tournerait en boucle sur EBADF : il n'est pas démarré et add() échouera
+    if (epollFd < 0 || eventFd < 0 || ::epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &event) < 0) {
+        logger(CRITICAL) << "Impossible de créer la boucle d'écoute (" << strerror(errno) << ")" << std::endl;
+        return;
+    }
+
+    ready = true;
+    thread = std::thread(&CanEventLoop::run, this);
+}
+
+
+int CanEventLoop::add(CAN &can) {
+    if (!ready) {
+        logger(ERROR) << "Boucle d'écoute indisponible, le bus " << can.interfaceName << " n'est pas ajouté" << std::endl;
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = &can;
+
+    if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, can.socket, &event) < 0) {
+        logger(ERROR) << "Impossible d'ajouter le bus " << can.interfaceName << " (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    buses.push_back(&can);
+    wake();
+    return 0;
+}
+
+
+void CanEventLoop::remove(CAN &can) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ::epoll_ctl(epollFd, EPOLL_CTL_DEL, can.socket, nullptr);
+    buses.erase(std::remove(buses.begin(), buses.end(), &can), buses.end());
+    generation++;
+
+    // Depuis un autre thread, on attend que la boucle ait fini de traiter ce bus. Depuis un callback
+    // (thread de la boucle), c'est un autre bus qui est en cours : la génération suffit à l'ignorer ensuite
+    if (std::this_thread::get_id() != thread.get_id())
+        idle.wait(lock, [&] { return current != &can; });
+}
+
+
+void CanEventLoop::wake() {
+    ::eventfd_write(eventFd, 1);
+}
+
+
+bool CanEventLoop::enter(CAN *can, uint64_t snapshotGeneration) {
+    // Un bus retiré depuis la copie de la liste n'est plus traité
+    std::lock_guard<std::mutex> lock(mutex);
+    if (generation != snapshotGeneration && std::find(buses.begin(), buses.end(), can) == buses.end())
+        return false;
+
+    current = can;
+    return true;
+}
+
+
+void CanEventLoop::leave() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = nullptr;
+    }
+
+    idle.notify_all();
+}
+
+
+void CanEventLoop::run() {
+    epoll_event events[16];
+    std::vector<CAN *> snapshot;                          // Copie de buses, parcourue sans verrou
+    uint64_t snapshotGeneration;
+
+    while (running.load()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            snapshot = buses;
+            snapshotGeneration = generation;
+        }
+
+        // On dort jusqu'à la prochaine échéance, tous bus confondus
+        int timeout = -1;
+        for (CAN *can : snapshot) {
+            if (!enter(can, snapshotGeneration))
+                continue;
+
+            int remaining = can->nextTimeout();
+            leave();
+
+            if (remaining >= 0 && (timeout < 0 || remaining < timeout))
+                timeout = remaining;
+        }
+
+        int count = ::epoll_wait(epollFd, events, 16, timeout);
+
+        // Les requêtes expirées appellent leurs callbacks de fin : même protection que pour les trames
+        for (CAN *can : snapshot) {
+            if (!enter(can, snapshotGeneration))
+                continue;
+
+            can->expireRequests();
+            leave();
+        }
+
+        if (count < 0) {
+            if (errno != EINTR)
+                logger(ERROR) << "Erreur lors de l'écoute des bus CAN (" << strerror(errno) << ")" << std::endl;
+            continue;
+        }
+
+        for (int i = 0; i < count; i++) {
+            auto *can = (CAN *) events[i].data.ptr;
+
+            if (can == nullptr) {
+                eventfd_t value;
+                ::eventfd_read(eventFd, &value);
+                continue;
+            }
+
+            // Le bus a pu être retiré pendant epoll_wait ou par un callback précédent
+            if (std::find(snapshot.begin(), snapshot.end(), can) == snapshot.end() || !enter(can, snapshotGeneration))
+                continue;
+
+            can->drain();
+            leave();
+        }
+    }
+}
+
+
+CanEventLoop::~CanEventLoop() {
+    if (thread.joinable()) {
+        running.store(false);
+        wake();
+        thread.join();
+    }
+
+    for (int fd : {epollFd, eventFd})
+        if (fd >= 0)
+            ::close(fd);
+}
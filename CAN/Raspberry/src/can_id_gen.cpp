@@ -0,0 +1,102 @@
+/*!
+ * @file can_id_gen.cpp
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Génère le header C can_id_layout.h à partir de can_id.h
+ * @details Usage : CAN_idgen [fichier] (sortie standard par défaut)
+ *          Après une modification de can_id.h : CAN_idgen include/can_id_layout.h
+ */
+
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "can_id.h"
+
+
+static std::string hex(uint32_t value) {
+    char buffer[16];
+    std::snprintf(buffer, sizeof(buffer), "0x%08Xu", value);
+    return buffer;
+}
+
+
+static std::string pad(const std::string &text, size_t width) {
+    return text.size() < width ? text + std::string(width - text.size(), ' ') : text + ' ';
+}
+
+
+static void generate(std::ostream &out) {
+    out << "/*!\n"
+           " * @file can_id_layout.h\n"
+           " * @brief Disposition des champs de l'identifiant CAN (29 bits), utilisable en C\n"
+           " * @details Fichier généré par CAN_idgen à partir de can_id.h : ne pas modifier à la main\n"
+           " */\n"
+           "\n"
+           "#ifndef CAN_ID_LAYOUT_H\n"
+           "#define CAN_ID_LAYOUT_H\n"
+           "\n"
+           "#ifdef __cplusplus\n"
+           "#include <cstdint>\n"
+           "#else\n"
+           "#include <stdint.h>\n"
+           "#include <stdbool.h>\n"
+           "#endif\n"
+           "\n";
+
+    // Macros : position, largeur et masque de chaque champ
+    for (const char *kind : {"OFFSET", "WIDTH", "MASK"}) {
+        for (const can_id_field_t &field : CAN_ID_FIELDS) {
+            std::string name = std::string("CAN_") + kind + "_" + field.name;
+            std::string value = kind[0] == 'O' ? std::to_string(field.offset)
+                              : kind[0] == 'W' ? std::to_string(field.width)
+                              : hex(field.mask());
+            out << "#define " << pad(name, 28) << value << "\n";
+        }
+        out << "\n";
+    }
+
+    out << "// Extraction d'un champ, par exemple CAN_ID_GET(id, FUNCTION_CODE)\n"
+           "#define CAN_ID_GET(id, field) (((uint32_t) (id) & CAN_MASK_##field) >> CAN_OFFSET_##field)\n"
+           "\n"
+           "// Identifiant sans le bit d'identifiant étendu (CAN_EFF_FLAG / IDE), chaque valeur est tronquée à son champ\n"
+           "static inline uint32_t can_id_encode(\n"
+           "        uint8_t priority, uint8_t sender, uint8_t receiver, uint8_t function_mode, uint16_t function_code,\n"
+           "        uint8_t message_id, bool is_response\n"
+           ") {\n";
+
+    // Dans l'ordre de CAN_ID_FIELDS
+    const char *arguments[] = {"priority", "sender", "receiver", "function_mode", "function_code", "message_id", "is_response"};
+    constexpr size_t count = sizeof(CAN_ID_FIELDS) / sizeof(CAN_ID_FIELDS[0]);
+    static_assert(count == sizeof(arguments) / sizeof(arguments[0]), "Un argument de can_id_encode par champ");
+
+    for (size_t i = 0; i < count; i++) {
+        const can_id_field_t &field = CAN_ID_FIELDS[i];
+        out << (i == 0 ? "    return " : "           ")
+            << "((uint32_t) " << arguments[i] << " & " << hex(field.max()) << ") << " << (int) field.offset
+            << (i + 1 < count ? " |\n" : ";\n");
+    }
+
+    out << "}\n"
+           "\n"
+           "#endif /* CAN_ID_LAYOUT_H */\n";
+}
+
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        generate(std::cout);
+        return 0;
+    }
+
+    std::ofstream file(argv[1]);
+    if (!file) {
+        std::cerr << "Impossible d'écrire " << argv[1] << std::endl;
+        return 1;
+    }
+
+    generate(file);
+    return file.good() ? 0 : 1;
+}
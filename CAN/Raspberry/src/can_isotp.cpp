@@ -0,0 +1,121 @@
+/*!
+ * @file can_isotp.cpp
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Fichier source de la classe CanIsoTp
+ */
+
+#include <cstring>
+#include <net/if.h>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/isotp.h>
+
+#include "../include/can_isotp.h"
+
+
+int CanIsoTp::init(
+        CanBus_Address address, CanBus_Address dest, CanBus_Fnct_Code FunctionCode, const can_isotp_config_t &config,
+        CanBus_Priority priority, CanBus_Fnct_Mode FunctionMode, const std::string &interface
+) {
+    // Le contrôle de flux n'a de sens qu'avec un seul destinataire
+    if (dest == CANBUS_BROADCAST) {
+        logger(ERROR) << "Un canal ISO-TP ne peut pas être en broadcast" << std::endl;
+        return -1;
+    }
+
+    socket = ::socket(PF_CAN, SOCK_DGRAM | SOCK_CLOEXEC, CAN_ISOTP);
+    if (socket < 0) {
+        logger(CRITICAL) << "Impossible de créer le socket ISO-TP (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    // send() ne rend la main qu'une fois toutes les trames parties (erreurs de contrôle de flux remontées)
+    can_isotp_options options{};
+    options.flags = CAN_ISOTP_WAIT_TX_DONE;
+    options.txpad_content = CAN_ISOTP_DEFAULT_PAD_CONTENT;
+    options.rxpad_content = CAN_ISOTP_DEFAULT_PAD_CONTENT;
+    if (config.padding)
+        options.flags |= CAN_ISOTP_TX_PADDING | CAN_ISOTP_RX_PADDING;
+
+    // Block size et STmin envoyés à l'émetteur dans nos trames de contrôle de flux
+    can_isotp_fc_options flowControl{config.blockSize, config.stMin, CAN_ISOTP_DEFAULT_RECV_WFTMAX};
+
+    if (::setsockopt(socket, SOL_CAN_ISOTP, CAN_ISOTP_OPTS, &options, sizeof(options)) < 0 ||
+        ::setsockopt(socket, SOL_CAN_ISOTP, CAN_ISOTP_RECV_FC, &flowControl, sizeof(flowControl)) < 0) {
+        logger(CRITICAL) << "Impossible de configurer le socket ISO-TP (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    if (config.fd) {
+        can_isotp_ll_options linkLayer{CANFD_MTU, CANFD_MAX_DLEN, CANFD_BRS};
+
+        if (::setsockopt(socket, SOL_CAN_ISOTP, CAN_ISOTP_LL_OPTS, &linkLayer, sizeof(linkLayer)) < 0) {
+            logger(CRITICAL) << "Impossible d'activer le CAN FD sur le socket ISO-TP (" << strerror(errno) << ")" << std::endl;
+            return -1;
+        }
+    }
+
+    // Nos trames (données et contrôle de flux) partent avec notre adresse d'émetteur, celles de dest arrivent avec la sienne
+    sockaddr_can addr{};
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = (int) if_nametoindex(interface.c_str());
+    addr.can_addr.tp.tx_id = canIdEncode(priority, address, dest, FunctionMode, FunctionCode) | CAN_EFF_FLAG;
+    addr.can_addr.tp.rx_id = canIdEncode(priority, dest, address, FunctionMode, FunctionCode) | CAN_EFF_FLAG;
+
+    if (addr.can_ifindex == 0 || ::bind(socket, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        logger(CRITICAL) << "Impossible de bind le socket ISO-TP sur " << interface << " (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    logger(INFO) << "Canal ISO-TP ouvert vers l'adresse " << (int) dest << std::endl;
+    return 0;
+}
+
+
+int CanIsoTp::send(std::span<const uint8_t> data) {
+    // Le noyau découpe en trame unique / première trame / trames consécutives et attend les contrôles de flux
+    if (::write(socket, data.data(), data.size()) < 0) {
+        logger(ERROR) << "Impossible d'envoyer " << data.size() << " octets (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+ssize_t CanIsoTp::receive(std::span<uint8_t> buffer, std::chrono::milliseconds timeout) {
+    // Renvoie la taille du message réassemblé, 0 si rien n'est arrivé avant le timeout
+    pollfd fd{socket, POLLIN, 0};
+    int ready = ::poll(&fd, 1, (int) timeout.count());
+
+    if (ready <= 0) {
+        if (ready < 0)
+            logger(ERROR) << "Erreur lors de l'attente d'un message ISO-TP (" << strerror(errno) << ")" << std::endl;
+        return ready;
+    }
+
+    // MSG_TRUNC : on obtient la taille réelle même si le buffer de l'appelant est trop petit
+    ssize_t size = ::recv(socket, buffer.data(), buffer.size(), MSG_TRUNC);
+
+    if (size < 0) {
+        logger(ERROR) << "Impossible de recevoir le message ISO-TP (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    if ((size_t) size > buffer.size()) {
+        logger(WARNING) << "Message ISO-TP tronqué : " << size << " octets pour un buffer de " << buffer.size() << std::endl;
+        return -1;
+    }
+
+    return size;
+}
+
+
+CanIsoTp::~CanIsoTp() {
+    if (socket >= 0)
+        ::close(socket);
+}
@@ -0,0 +1,109 @@
+/*!
+ * @file can_queue.cpp
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Fichier source de la classe CanRxQueue
+ */
+
+#include <bit>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+#include "../include/can_queue.h"
+
+
+static_assert(std::atomic_ref<uint32_t>::is_always_lock_free, "Copie des trames sans verrou");
+static_assert(std::is_trivially_copyable_v<CanBus_FrameFormat>);
+
+
+CanRxQueue::CanRxQueue(size_t size, can_overflow_t overflow)
+    : size(std::bit_ceil(std::max<size_t>(size, 2))), mask(this->size - 1), overflow(overflow),
+      ring(std::make_unique<slot_t[]>(this->size)) {}
+
+
+void CanRxQueue::store(slot_t &slot, const CanBus_FrameFormat &frame) {
+    uint32_t words[CAN_QUEUE_WORDS]{};
+    memcpy(words, &frame, sizeof(frame));
+
+    // Séquence impaire avant les données, paire après (écrivain unique : le producteur)
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < CAN_QUEUE_WORDS; i++)
+        std::atomic_ref<uint32_t>(slot.words[i]).store(words[i], std::memory_order_relaxed);
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+
+bool CanRxQueue::load(const slot_t &slot, CanBus_FrameFormat &frame) {
+    uint32_t before = slot.sequence.load(std::memory_order_acquire);
+    if (before & 1)
+        return false;
+
+    uint32_t words[CAN_QUEUE_WORDS];
+    for (size_t i = 0; i < CAN_QUEUE_WORDS; i++)
+        words[i] = std::atomic_ref<uint32_t>(const_cast<uint32_t &>(slot.words[i])).load(std::memory_order_relaxed);
+
+    // Séquence inchangée : le producteur n'a pas touché à la place pendant la copie
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != before)
+        return false;
+
+    memcpy(&frame, words, sizeof(frame));
+    return true;
+}
+
+
+bool CanRxQueue::push(const CanBus_FrameFormat &frame) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+
+    if (t - h == size) {
+        if (overflow != CAN_OVERFLOW_DROP_OLDEST) {
+            droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        // On libère la plus ancienne place. Si le CAS échoue, le consommateur vient de la lire : rien n'est perdu
+        if (head.compare_exchange_strong(h, h + 1, std::memory_order_acq_rel))
+            droppedFrames.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    store(ring[t & mask], frame);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+
+bool CanRxQueue::pop(CanBus_FrameFormat &frame) {
+    size_t h = head.load(std::memory_order_acquire);
+
+    while (h != tail.load(std::memory_order_acquire)) {
+        // Copie incohérente (place en cours de réécriture) : la trame h est perdue, on relit la tête
+        if (!load(ring[h & mask], frame)) {
+            h = head.load(std::memory_order_acquire);
+            continue;
+        }
+
+        // Tête inchangée : la copie est bien la trame h, pas celle qui l'a remplacée
+        if (head.compare_exchange_strong(h, h + 1, std::memory_order_acq_rel))
+            return true;
+
+        // Sinon h contient la nouvelle tête (trame écrasée en CAN_OVERFLOW_DROP_OLDEST), on recommence
+    }
+
+    return false;
+}
+
+
+size_t CanRxQueue::pop(std::span<CanBus_FrameFormat> frames) {
+    size_t count = 0;
+    while (count < frames.size() && pop(frames[count]))
+        count++;
+
+    return count;
+}
@@ -0,0 +1,241 @@
+/*!
+ * @file can_recorder.cpp
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Fichier source des classes CanRecorder et CanRecordReader
+ */
+
+#include <fcntl.h>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../include/can_recorder.h"
+
+
+static constexpr char CAN_RECORD_MAGIC[8] = {'C', 'A', 'N', 'R', 'E', 'C', '0', '1'};
+
+// En-tête d'un enregistrement en version 1 (sans horodatage monotone)
+struct can_record_v1_t {
+    uint64_t Timestamp;
+    uint32_t can_id;
+    uint8_t len;
+    uint8_t flags;
+    uint16_t size;
+};
+
+
+// Le champ size termine l'en-tête dans les deux versions : CanRecordReader::next le lit avant de connaître le reste
+static_assert(offsetof(can_record_v1_t, size) == sizeof(can_record_v1_t) - sizeof(uint16_t));
+static_assert(offsetof(can_record_t, size) == sizeof(can_record_t) - sizeof(uint16_t));
+
+
+static uint64_t clockNow(clockid_t clock) {
+    timespec now{};
+    ::clock_gettime(clock, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+int CanRecorder::open(const std::string &path, uint32_t size) {
+    // La taille des fenêtres doit être un multiple de la taille des pages pour mmap
+    if (size == 0 || size % ::sysconf(_SC_PAGESIZE) != 0) {
+        logger(ERROR) << "Taille de fenêtre invalide : " << size << std::endl;
+        return -1;
+    }
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        logger(ERROR) << "Impossible de créer " << path << " (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    chunkSize = size;
+    mapOffset = 0;
+    if (mapChunk() < 0)
+        return -1;
+
+    can_record_file_t header{};
+    memcpy(header.magic, CAN_RECORD_MAGIC, sizeof(header.magic));
+    header.version = CAN_RECORD_VERSION;
+    header.chunkSize = chunkSize;
+
+    memcpy(map, &header, sizeof(header));
+    position = sizeof(header);
+
+    logger(INFO) << "Enregistrement des trames dans " << path << std::endl;
+    return 0;
+}
+
+
+int CanRecorder::mapChunk() {
+    // Le fichier est agrandi d'une fenêtre (les pages restent creuses tant qu'elles ne sont pas écrites)
+    if (::ftruncate(fd, (off_t) (mapOffset + chunkSize)) < 0) {
+        logger(ERROR) << "Impossible d'agrandir l'enregistrement (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    void *window = ::mmap(nullptr, chunkSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t) mapOffset);
+    if (window == MAP_FAILED) {
+        logger(ERROR) << "Impossible de projeter l'enregistrement (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    map = (uint8_t *) window;
+    position = 0;
+    return 0;
+}
+
+
+void CanRecorder::append(const canfd_frame &buffer, size_t size, uint64_t timestamp) {
+    uint8_t len = std::min<uint8_t>(buffer.len, CANFD_MAX_DLEN);
+    uint16_t recordSize = (sizeof(can_record_t) + len + 7) & ~7;
+
+    // L'instant de réception (horodatage noyau en CLOCK_REALTIME, 0 si absent) est aussi converti en CLOCK_MONOTONIC.
+    // clock_gettime passe par le vDSO : pas d'appel système
+    uint64_t realtime = clockNow(CLOCK_REALTIME);
+    uint64_t monotonic = clockNow(CLOCK_MONOTONIC);
+    if (timestamp == 0)
+        timestamp = realtime;
+    else
+        monotonic -= std::min(monotonic, realtime > timestamp ? realtime - timestamp : 0);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (map == nullptr)
+        return;
+
+    // Fenêtre pleine : la fin reste à 0 (size = 0) et on passe à la suivante.
+    // munmap ne fait que libérer la projection, le noyau écrit les pages sur le disque à son rythme
+    if (position + recordSize > chunkSize) {
+        ::munmap(map, chunkSize);
+        map = nullptr;
+        mapOffset += chunkSize;
+
+        if (mapChunk() < 0)
+            return;
+    }
+
+    auto *record = (can_record_t *) (map + position);
+    record->Timestamp = timestamp;
+    record->Monotonic = monotonic;
+    record->can_id = buffer.can_id;
+    record->len = len;
+    record->flags = buffer.flags | (size == CANFD_MTU ? CANFD_FDF : 0);
+    memcpy(map + position + sizeof(can_record_t), buffer.data, len);
+    record->size = recordSize;
+
+    position += recordSize;
+}
+
+
+void CanRecorder::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0)
+        return;
+
+    // On retire la partie non utilisée de la dernière fenêtre
+    if (map != nullptr) {
+        ::munmap(map, chunkSize);
+        map = nullptr;
+        ::ftruncate(fd, (off_t) (mapOffset + position));
+    }
+
+    ::close(fd);
+    fd = -1;
+}
+
+
+CanRecorder::~CanRecorder() {
+    close();
+}
+
+
+int CanRecordReader::open(const std::string &path) {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    // L'en-tête est lu directement : la taille des fenêtres n'est connue qu'après
+    struct stat info{};
+    can_record_file_t header{};
+    if (fd < 0 || ::fstat(fd, &info) < 0 || ::pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+        logger(ERROR) << "Impossible de lire l'enregistrement " << path << std::endl;
+        return -1;
+    }
+
+    if (memcmp(header.magic, CAN_RECORD_MAGIC, sizeof(header.magic)) != 0 || header.version < 1 || header.version > CAN_RECORD_VERSION ||
+        header.chunkSize == 0 || header.chunkSize % ::sysconf(_SC_PAGESIZE) != 0) {
+        logger(ERROR) << path << " n'est pas un enregistrement CAN" << std::endl;
+        return -1;
+    }
+
+    fileSize = info.st_size;
+    fileVersion = header.version;
+    chunkSize = header.chunkSize;
+    offset = sizeof(can_record_file_t);
+    return mapChunk(0);
+}
+
+
+int CanRecordReader::mapChunk(uint64_t chunk) {
+    // La fenêtre précédente est libérée : ses pages sont rendues au noyau (pas de croissance de la mémoire)
+    if (map != nullptr)
+        ::munmap((void *) map, mapSize);
+
+    map = nullptr;
+    mapOffset = chunk * chunkSize;
+    mapSize = (uint32_t) std::min<uint64_t>(chunkSize, fileSize - mapOffset);
+
+    void *window = ::mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, (off_t) mapOffset);
+    if (window == MAP_FAILED) {
+        logger(ERROR) << "Impossible de projeter l'enregistrement (" << strerror(errno) << ")" << std::endl;
+        return -1;
+    }
+
+    map = (const uint8_t *) window;
+    ::madvise(window, mapSize, MADV_SEQUENTIAL);
+    return 0;
+}
+
+
+const can_record_t *CanRecordReader::next() {
+    // Taille de l'en-tête d'un enregistrement selon la version, le champ size est toujours le dernier
+    const size_t headerSize = fileVersion == 1 ? sizeof(can_record_v1_t) : sizeof(can_record_t);
+
+    while (map != nullptr && offset + headerSize <= fileSize) {
+        // Aucun enregistrement ne chevauche deux fenêtres (voir CanRecorder::append)
+        if (offset >= mapOffset + mapSize && mapChunk(offset / chunkSize) < 0)
+            return nullptr;
+
+        // Fin de fenêtre trop courte pour un en-tête, ou marquée par size = 0 : on passe à la suivante
+        uint32_t position = offset - mapOffset;
+        uint16_t size = position + headerSize <= mapSize ? *(const uint16_t *) (map + position + headerSize - sizeof(uint16_t)) : 0;
+
+        if (size != 0 && position + size <= mapSize) {
+            offset += size;
+
+            if (fileVersion != 1)
+                return (const can_record_t *) (map + position);
+
+            const auto *old = (const can_record_v1_t *) (map + position);
+            auto *record = (can_record_t *) converted;
+            *record = {old->Timestamp, 0, old->can_id, std::min<uint8_t>(old->len, CANFD_MAX_DLEN), old->flags, old->size};
+            memcpy(converted + sizeof(can_record_t), old + 1, record->len);
+            return record;
+        }
+
+        offset = mapOffset + chunkSize;
+    }
+
+    return nullptr;
+}
+
+
+CanRecordReader::~CanRecordReader() {
+    if (map != nullptr)
+        ::munmap((void *) map, mapSize);
+    if (fd >= 0)
+        ::close(fd);
+}
@@ -0,0 +1,118 @@
+/*!
+ * @file can_replay.cpp
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Rejoue un enregistrement de CanRecorder sur une interface (vcan0 par défaut)
+ * @details Usage : CAN_replay <fichier> [interface] [vitesse]
+ *          vitesse = 1 (temps réel, défaut), N (N fois plus vite) ou 0 (au plus vite)
+ */
+
+#include <ctime>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <net/if.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include "../include/can_recorder.h"
+
+
+static uint64_t monotonicNow() {
+    timespec now{};
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "Usage : " << argv[0] << " <fichier> [interface] [vitesse]" << std::endl;
+        return 1;
+    }
+
+    std::string interface = argc > 2 ? argv[2] : "vcan0";
+    double speed = argc > 3 ? std::strtod(argv[3], nullptr) : 1.0;
+
+    CanRecordReader reader;
+    if (reader.open(argv[1]) < 0)
+        return 1;
+
+    // Socket en émission seule : aucun filtre de réception, trames FD autorisées si l'interface les supporte
+    int sock = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    int enabled = 1;
+    ::setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, nullptr, 0);
+    ::setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enabled, sizeof(enabled));
+
+    sockaddr_can addr{};
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = (int) if_nametoindex(interface.c_str());
+
+    if (addr.can_ifindex == 0 || ::bind(sock, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        std::cerr << "Impossible d'utiliser l'interface " << interface << " (" << strerror(errno) << ")" << std::endl;
+        return 1;
+    }
+
+    // Rythme du rejeu : horodatage monotone (version 2). En version 1, seul CLOCK_REALTIME est disponible
+    // et l'heure a pu être réglée pendant l'enregistrement (NTP au démarrage, le Pi n'a pas d'horloge RTC) :
+    // un écart négatif entre deux trames est ramené à 0 au lieu de faire attendre indéfiniment
+    if (reader.version() < 2)
+        std::cerr << "Enregistrement en version " << reader.version() << " : rythme basé sur CLOCK_REALTIME" << std::endl;
+
+    uint64_t previous = 0, recorded = 0, start = monotonicNow();
+    uint64_t frames = 0, skipped = 0;
+
+    while (const can_record_t *record = reader.next()) {
+        // Les trames d'erreur sont générées par les contrôleurs, on ne peut pas les injecter
+        if (record->can_id & CAN_ERR_FLAG) {
+            skipped++;
+            continue;
+        }
+
+        // Temps écoulé depuis la première trame, dans le temps de l'enregistrement
+        uint64_t time = reader.version() < 2 ? record->Timestamp : record->Monotonic;
+        if (frames > 0)
+            recorded += std::max<int64_t>((int64_t) (time - previous), 0);
+        previous = time;
+
+        // Échéance absolue : les retards ne s'accumulent pas d'une trame à l'autre
+        if (speed > 0) {
+            uint64_t target = start + (uint64_t) (recorded / speed);
+            timespec deadline{(time_t) (target / 1000000000), (long) (target % 1000000000)};
+            while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR);
+        }
+
+        canfd_frame buffer{};
+        buffer.can_id = record->can_id;
+        buffer.len = record->len;
+        buffer.flags = record->flags;
+        memcpy(buffer.data, record->data(), record->len);
+
+        size_t size = record->flags & CANFD_FDF ? CANFD_MTU : CAN_MTU;
+
+        // File d'émission pleine (ENOBUFS) : on attend au lieu de perdre la trame
+        while (::write(sock, &buffer, size) < 0) {
+            if (errno != ENOBUFS) {
+                std::cerr << "Impossible d'envoyer la trame " << std::hex << buffer.can_id << std::dec
+                          << " (" << strerror(errno) << ")" << std::endl;
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+
+        frames++;
+    }
+
+    double elapsed = (monotonicNow() - start) / 1e9;
+    std::cout << frames << " trame(s) rejouée(s) en " << elapsed << " s";
+    if (skipped > 0)
+        std::cout << ", " << skipped << " trame(s) d'erreur ignorée(s)";
+    std::cout << std::endl;
+
+    ::close(sock);
+    return 0;
+}
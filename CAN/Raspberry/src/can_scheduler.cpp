@@ -0,0 +1,252 @@
+/*!
+ * @file can_scheduler.cpp
+ * @version 1.3
+ * @date 2023-2024
+ * @author Romain ADAM
+ * @brief Fichier source de la classe CanScheduler
+ */
+
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <linux/pkt_sched.h>
+
+#include "../include/can_scheduler.h"
+
+
+// Priorité du socket (skb->priority) pour chaque CanBus_Priority : pfifo_fast
+// place TC_PRIO_INTERACTIVE dans la bande 0, BESTEFFORT dans la 1 et BULK dans la 2
+static constexpr int socketPriorities[CAN_PRIORITY_COUNT] = {
+    TC_PRIO_INTERACTIVE, TC_PRIO_BESTEFFORT, TC_PRIO_FILLER, TC_PRIO_BULK
+};
+
+
+CanScheduler::CanScheduler(
+        int socket, can_tx_mode_t mode, bool socketPriority,
+        const std::array<can_tx_queue_t, CAN_PRIORITY_COUNT> &config, std::atomic<uint64_t> *txErrors, std::array<int, CAN_PRIORITY_COUNT> weights
+): socket(socket), mode(mode), socketPriority(socketPriority), weights(weights), credits(weights), txErrors(txErrors) {
+    // Les files sont allouées une seule fois : push() ne fait ensuite aucune allocation
+    for (int priority = 0; priority < CAN_PRIORITY_COUNT; priority++) {
+        queues[priority].config = config[priority];
+        queues[priority].ring.resize(std::max<size_t>(config[priority].size, 1));
+    }
+
+    // getsockopt renvoie le double de la valeur demandée (marge du noyau) : on garde la moitié pour la rétablir
+    int size = 0;
+    socklen_t length = sizeof(size);
+    if (::getsockopt(socket, SOL_SOCKET, SO_SNDBUF, &size, &length) == 0 &&
+        ::setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &CAN_TX_SEND_BUFFER, sizeof(int)) == 0)
+        sendBuffer = size / 2;
+    else
+        logger(WARNING) << "Impossible de réduire SO_SNDBUF, la file du noyau peut retarder les trames prioritaires" << std::endl;
+
+    thread = std::thread(&CanScheduler::run, this);
+}
+
+
+bool CanScheduler::push(const canfd_frame &buffer) {
+    int priority = CAN_FIELD_PRIORITY.decode(buffer.can_id);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue_t &queue = queues[priority];
+        size_t size = queue.ring.size();
+
+        if (queue.count == size) {
+            // La tête de file est peut-être en cours d'écriture : c'est alors la suivante qui est écrasée
+            size_t oldest = writing == priority;
+            if (queue.config.overflow != CAN_OVERFLOW_DROP_OLDEST || oldest >= queue.count) {
+                rejectedFrames.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            droppedFrames.fetch_add(1, std::memory_order_relaxed);
+
+            if (oldest == 1)
+                queue.ring[(queue.head + 1) % size] = queue.ring[queue.head];
+
+            queue.head = (queue.head + 1) % size;
+            queue.count--;
+        }
+
+        queue.ring[(queue.head + queue.count) % size] = {buffer, std::chrono::steady_clock::now()};
+        queue.count++;
+    }
+
+    cv.notify_one();
+    return true;
+}
+
+
+void CanScheduler::pop(int priority) {
+    queue_t &queue = queues[priority];
+    queue.head = (queue.head + 1) % queue.ring.size();
+    queue.count--;
+}
+
+
+int CanScheduler::select() {
+    // Mode strict : la première file non vide, de la plus prioritaire à la moins prioritaire
+    if (mode == CAN_TX_STRICT) {
+        for (int priority = 0; priority < CAN_PRIORITY_COUNT; priority++)
+            if (queues[priority].count > 0)
+                return priority;
+
+        return -1;
+    }
+
+    // Mode pondéré : chaque file a droit à weights[p] trames par tour
+    for (int round = 0; round < 2; round++) {
+        for (int priority = 0; priority < CAN_PRIORITY_COUNT; priority++)
+            if (queues[priority].count > 0 && credits[priority] > 0)
+                return priority;
+
+        // Tour terminé (ou files ayant encore du crédit vides) : on recharge les crédits
+        credits = weights;
+    }
+
+    return -1;
+}
+
+
+void CanScheduler::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Refus consécutifs du noyau (bus saturé ou en bus-off) pour la trame en tête
+    std::chrono::microseconds delay = CAN_TX_RETRY_DELAY;
+    std::chrono::steady_clock::time_point busySince{};
+
+    while (true) {
+        int priority = -1;
+        cv.wait(lock, [&] { return stopping || (priority = select()) >= 0; });
+
+        if (stopping)
+            return;
+
+        // Trame en file depuis trop longtemps (bus saturé ou en bus-off) : abandonnée plutôt qu'envoyée en retard
+        queue_t &queue = queues[priority];
+        const entry_t &front = queue.ring[queue.head];
+        std::chrono::nanoseconds maxAge = queue.config.maxAge;
+
+        if (maxAge > std::chrono::nanoseconds::zero() && std::chrono::steady_clock::now() - front.time > maxAge) {
+            pop(priority);
+            expiredFrames.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // La trame reste en tête de file tant qu'elle n'est pas partie : une trame
+        // plus prioritaire arrivée pendant l'attente passera avant elle
+        canfd_frame buffer = front.buffer;
+        writing = priority;
+
+        lock.unlock();
+        int status = write(buffer);
+        lock.lock();
+
+        writing = -1;
+
+        if (status == -ENOBUFS) {
+            // Trame sans âge maximum : abandonnée après CAN_TX_BUSY_TIMEOUT pour ne pas réessayer indéfiniment
+            auto now = std::chrono::steady_clock::now();
+            if (busySince == std::chrono::steady_clock::time_point{})
+                busySince = now;
+
+            if (maxAge == std::chrono::nanoseconds::zero() && now - busySince > std::chrono::milliseconds(CAN_TX_BUSY_TIMEOUT)) {
+                fail(buffer, ENOBUFS);
+                status = 0;
+            } else {
+                // ENOBUFS ne déclenche pas POLLOUT sur les sockets CAN : attente croissante, interrompue par stop()
+                cv.wait_for(lock, delay, [this] { return stopping; });
+                delay = std::min<std::chrono::microseconds>(2 * delay, std::chrono::milliseconds(CAN_TX_BUSY_TIMEOUT));
+                continue;
+            }
+        }
+
+        delay = CAN_TX_RETRY_DELAY;
+        busySince = {};
+        if (status < 0)
+            continue;
+
+        pop(priority);
+        credits[priority]--;
+    }
+}
+
+
+int CanScheduler::write(const canfd_frame &buffer) {
+    int priority = CAN_FIELD_PRIORITY.decode(buffer.can_id);
+
+    if (socketPriority && priority != currentPriority) {
+        if (::setsockopt(socket, SOL_SOCKET, SO_PRIORITY, &socketPriorities[priority], sizeof(int)) == 0)
+            currentPriority = priority;
+    }
+
+    if (::write(socket, &buffer, canMtu(buffer)) >= 0) {
+        if (logFrames)
+            logger(INFO) << "Message envoyé : " << std::showbase << std::hex << buffer.can_id << std::dec << std::endl;
+
+        return 0;
+    }
+
+    switch (errno) {
+        // SO_SNDBUF atteint (cas normal sous charge) : on attend que le noyau libère une place
+        case EAGAIN: {
+            pollfd fd{socket, POLLOUT, 0};
+            ::poll(&fd, 1, CAN_TX_BUSY_TIMEOUT);
+            return -1;
+        }
+
+        // File de l'interface pleine : nouvel essai par run(), après une attente
+        case ENOBUFS:
+            if (txErrors)
+                txErrors[CAN_FIELD_RECEIVER_ADDR.decode(buffer.can_id)].fetch_add(1, std::memory_order_relaxed);
+            return -ENOBUFS;
+
+        default:
+            if (txErrors)
+                txErrors[CAN_FIELD_RECEIVER_ADDR.decode(buffer.can_id)].fetch_add(1, std::memory_order_relaxed);
+            fail(buffer, errno);
+            return 0;
+    }
+}
+
+
+void CanScheduler::fail(const canfd_frame &buffer, int error) {
+    droppedFrames.fetch_add(1, std::memory_order_relaxed);
+    logger(ERROR) << "Impossible d'écrire dans le buffer (" << strerror(error) << "), trame abandonnée : "
+                  << std::showbase << std::hex << buffer.can_id << std::dec << std::endl;
+}
+
+
+void CanScheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+            return;
+
+        stopping = true;
+    }
+
+    cv.notify_one();
+    thread.join();
+
+    if (sendBuffer >= 0)
+        ::setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(int));
+
+    // Les trames encore en file ne partiront pas : elles sont comptées comme abandonnées
+    size_t remaining = 0;
+    for (const queue_t &queue : queues)
+        remaining += queue.count;
+
+    if (remaining > 0) {
+        droppedFrames.fetch_add(remaining, std::memory_order_relaxed);
+        logger(WARNING) << remaining << " trame(s) en file abandonnée(s) à l'arrêt de l'ordonnanceur" << std::endl;
+    }
+}
+
+
+CanScheduler::~CanScheduler() {
+    stop();
+}
@@ -1,22 +1,76 @@
+#include <cstring>
+#include <string>
+#include <thread>
+
 #include "can.h"
+#include "can_queue.h"
 
 
-void handleAcknowledge(CAN &can, const CanBus_FrameFormat &frame) {
-    if (frame.Data[0] == 0x01)
+void handleAcknowledge(CAN &can, const CanBus_FrameFormat &frame, const AccuserReception &ack) {
+    if (ack.Status == CAN_ACK)
         std::cout << "ACK" << std::endl;
     else
         std::cout << "NACK" << std::endl;
 
-    can.send((CanBus_Priority) frame.Priority,(CanBus_Address) frame.SenderAddress,(CanBus_Fnct_Mode) 0x00,(CanBus_Fnct_Code) frame.FunctionCode, {0x01}, frame.MessageID, true);
+    can.send<FCT_ACCUSER_RECEPTION>((CanBus_Priority) frame.Priority,(CanBus_Address) frame.SenderAddress,(CanBus_Fnct_Mode) 0x00, {CAN_ACK}, frame.MessageID, true);
+}
+
+
+// Producteur et consommateur concurrents sur CanRxQueue : chaque trame lue doit être entière
+// (pas de mélange de deux écritures) et plus récente que la précédente, trames lues + perdues = trames écrites
+static int queueStress(can_overflow_t overflow) {
+    constexpr uint64_t count = 1000000;
+    CanRxQueue queue(64, overflow);
+
+    std::thread producer([&queue] {
+        CanBus_FrameFormat frame{};
+        frame.Length = CANFD_MAX_DLEN;
+
+        for (uint64_t i = 1; i <= count; i++) {
+            std::memset(frame.Data, (uint8_t) i, sizeof(frame.Data));
+            frame.Timestamp = i;
+            queue.push(frame);
+        }
+    });
+
+    CanBus_FrameFormat frame{};
+    uint64_t last = 0, received = 0, errors = 0;
+
+    auto check = [&] {
+        bool consistent = frame.Timestamp > last && frame.Length == CANFD_MAX_DLEN;
+        for (uint8_t byte : frame.Data)
+            consistent = consistent && byte == (uint8_t) frame.Timestamp;
+
+        errors += !consistent;
+        last = frame.Timestamp;
+        received++;
+    };
+
+    while (received + queue.dropped() < count)
+        if (queue.pop(frame))
+            check();
+
+    producer.join();
+    while (queue.pop(frame))
+        check();
+
+    std::cout << (overflow == CAN_OVERFLOW_DROP_OLDEST ? "DROP_OLDEST" : "DROP_NEWEST") << " : " << received << " lues, "
+              << queue.dropped() << " perdues, " << errors << " incohérentes" << std::endl;
+
+    return errors == 0 && received + queue.dropped() == count ? 0 : 1;
 }
 
 
-int main() {
+int main(int argc, char **argv) {
+    // Test sans bus CAN : CAN_test --queue
+    if (argc > 1 && std::string(argv[1]) == "--queue")
+        return queueStress(CAN_OVERFLOW_DROP_OLDEST) | queueStress(CAN_OVERFLOW_DROP_NEWEST);
+
     CAN can;
     if (can.init(CANBUS_RASPBERRY) < 0)
         return 1;
 
-    can.bind(FCT_ACCUSER_RECEPTION, handleAcknowledge);
+    can.on<FCT_ACCUSER_RECEPTION>(handleAcknowledge);
     can.startListening();
 
     // Exemple d'envoi d'un message, ici on aura toujours CAN_TIMEOUT (aucun send dans handleAcknowledge)